@@ -0,0 +1,544 @@
+#define _POSIX_C_SOURCE 200809L // For clock_gettime
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vma.h"
+
+// Bytes of every miniblock the benchmarks build
+#define BENCH_MINIBLOCK 64
+// Free bytes between two blocks: room for one miniblock touching either side, or two touching both
+#define BENCH_GAP (2 * BENCH_MINIBLOCK)
+// Most operations timed together in one round
+#define BENCH_BATCH 1024
+// Rounds of every measurement; the fastest is reported, as the others only add noise
+#define BENCH_ROUNDS 5
+// Shortest a round may last; batches are repeated until it does, which steadies small shapes
+#define BENCH_ROUND_NS 2000000
+// Ratio to the baseline past which a row counts as a regression; short operations easily vary
+// by half between runs, while a change in complexity shows as a multiple on the larger shapes
+#define BENCH_TOLERANCE 2.0
+// Stride through the blocks, a prime so that it visits each one once
+#define BENCH_STEP 7919
+
+// Definition of an arena of blocks equally spaced, each made of the same number of miniblocks
+typedef struct
+{
+    arena_t *arena;
+    uint64_t blocks;
+    uint64_t miniblocks; // Per block
+    uint64_t stride;     // From the start of a block to the start of the next
+    uint64_t seed;
+} shape_t;
+
+// Definition of what one operation works on
+typedef struct
+{
+    uint64_t address;
+    uint64_t size;
+} target_t;
+
+// Definition of a benchmarked case. Targets are picked before the timer starts, and whatever
+// the operations changed is put back after it stops, so every round sees the same shape.
+typedef struct
+{
+    const char *primitive;
+    const char *name;
+    uint64_t min_miniblocks; // Shapes with fewer miniblocks per block skip the case
+    uint64_t max_miniblocks;
+    int spans; // Swept over the number of miniblocks an access spans
+    size_t (*pick)(shape_t *shape, uint64_t span, target_t *targets);
+    vma_status_t (*op)(shape_t *shape, const target_t *target);
+    vma_status_t (*undo)(shape_t *shape, const target_t *target);
+} bench_case_t;
+
+// Definition of a row of a saved baseline, looked up by everything but its timing
+typedef struct
+{
+    char key[128];
+    double ns_per_op;
+} baseline_row_t;
+
+// Definition of a saved baseline and how the current run compares to it
+typedef struct
+{
+    baseline_row_t *rows;
+    size_t count;
+    double tolerance;
+    int regressions;
+} baseline_t;
+
+static uint8_t payload[BENCH_BATCH * BENCH_MINIBLOCK];
+static uint8_t buffer[BENCH_BATCH * BENCH_MINIBLOCK];
+
+// Function to read the monotonic clock in nanoseconds
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Function to draw the next pseudo-random number of a shape (xorshift64)
+static uint64_t next_random(shape_t *shape)
+{
+    shape->seed ^= shape->seed << 13;
+    shape->seed ^= shape->seed >> 7;
+    shape->seed ^= shape->seed << 17;
+    return shape->seed;
+}
+
+// Function to get the start address of a block of the shape
+static uint64_t block_start(const shape_t *shape, const uint64_t block)
+{
+    return BENCH_GAP + block * shape->stride;
+}
+
+// Function to get the end address of a block of the shape
+static uint64_t block_end(const shape_t *shape, const uint64_t block)
+{
+    return block_start(shape, block) + shape->miniblocks * BENCH_MINIBLOCK;
+}
+
+// Function to build a shape: every block is allocated one miniblock at a time, then written whole
+static int create_shape(shape_t *shape, const uint64_t blocks, const uint64_t miniblocks)
+{
+    uint64_t done = 0;
+
+    shape->blocks = blocks;
+    shape->miniblocks = miniblocks;
+    shape->stride = miniblocks * BENCH_MINIBLOCK + BENCH_GAP;
+    shape->seed = 0x9E3779B97F4A7C15ull ^ (blocks << 20) ^ miniblocks;
+    shape->arena = vma_alloc_arena(BENCH_GAP + blocks * shape->stride);
+    if (shape->arena == NULL)
+        return 0;
+
+    for (uint64_t i = 0; i < blocks; i++)
+    {
+        for (uint64_t j = 0; j < miniblocks; j++)
+            if (vma_alloc_block(shape->arena, block_start(shape, i) + j * BENCH_MINIBLOCK,
+                                BENCH_MINIBLOCK) != VMA_OK)
+                return 0;
+        if (vma_write(shape->arena, block_start(shape, i), miniblocks * BENCH_MINIBLOCK, payload,
+                      &done) != VMA_OK)
+            return 0;
+    }
+    return 1;
+}
+
+// Function to pick distinct blocks in a scattered order, all but the last one so that each
+// has a neighbour after it
+static size_t pick_blocks(shape_t *shape, uint64_t *blocks)
+{
+    size_t count = shape->blocks - 1 < BENCH_BATCH ? shape->blocks - 1 : BENCH_BATCH;
+    uint64_t first = next_random(shape);
+
+    for (size_t i = 0; i < count; i++)
+        blocks[i] = (first + i * BENCH_STEP) % (shape->blocks - 1);
+    return count;
+}
+
+// Function to pick the first half of the gap after each block, so a new miniblock merges left
+static size_t pick_merge_left(shape_t *shape, uint64_t span, target_t *targets)
+{
+    uint64_t blocks[BENCH_BATCH];
+    size_t count = pick_blocks(shape, blocks);
+
+    (void)span;
+    for (size_t i = 0; i < count; i++)
+    {
+        targets[i].address = block_end(shape, blocks[i]);
+        targets[i].size = BENCH_MINIBLOCK;
+    }
+    return count;
+}
+
+// Function to pick the second half of the gap after each block, so a new miniblock merges right
+static size_t pick_merge_right(shape_t *shape, uint64_t span, target_t *targets)
+{
+    uint64_t blocks[BENCH_BATCH];
+    size_t count = pick_blocks(shape, blocks);
+
+    (void)span;
+    for (size_t i = 0; i < count; i++)
+    {
+        targets[i].address = block_end(shape, blocks[i]) + BENCH_MINIBLOCK;
+        targets[i].size = BENCH_MINIBLOCK;
+    }
+    return count;
+}
+
+// Function to pick the whole gap after each block, so a new miniblock joins two blocks
+static size_t pick_merge_both(shape_t *shape, uint64_t span, target_t *targets)
+{
+    uint64_t blocks[BENCH_BATCH];
+    size_t count = pick_blocks(shape, blocks);
+
+    (void)span;
+    for (size_t i = 0; i < count; i++)
+    {
+        targets[i].address = block_end(shape, blocks[i]);
+        targets[i].size = BENCH_GAP;
+    }
+    return count;
+}
+
+// Function to pick the miniblock at the given position of each block
+static size_t pick_position(shape_t *shape, const uint64_t position, target_t *targets)
+{
+    uint64_t blocks[BENCH_BATCH];
+    size_t count = pick_blocks(shape, blocks);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        targets[i].address = block_start(shape, blocks[i]) + position * BENCH_MINIBLOCK;
+        targets[i].size = BENCH_MINIBLOCK;
+    }
+    return count;
+}
+
+// Function to pick the first miniblock of each block
+static size_t pick_head(shape_t *shape, uint64_t span, target_t *targets)
+{
+    (void)span;
+    return pick_position(shape, 0, targets);
+}
+
+// Function to pick the last miniblock of each block
+static size_t pick_tail(shape_t *shape, uint64_t span, target_t *targets)
+{
+    (void)span;
+    return pick_position(shape, shape->miniblocks - 1, targets);
+}
+
+// Function to pick the middle miniblock of each block
+static size_t pick_middle(shape_t *shape, uint64_t span, target_t *targets)
+{
+    (void)span;
+    return pick_position(shape, shape->miniblocks / 2, targets);
+}
+
+// Function to pick random runs of span miniblocks, each inside one block
+static size_t pick_span(shape_t *shape, uint64_t span, target_t *targets)
+{
+    uint64_t block = 0;
+
+    for (size_t i = 0; i < BENCH_BATCH; i++)
+    {
+        block = next_random(shape) % shape->blocks;
+        targets[i].address = block_start(shape, block) +
+                             next_random(shape) % (shape->miniblocks - span + 1) * BENCH_MINIBLOCK;
+        targets[i].size = span * BENCH_MINIBLOCK;
+    }
+    return BENCH_BATCH;
+}
+
+// Function to pick random miniblocks anywhere in the arena
+static size_t pick_miniblock(shape_t *shape, uint64_t span, target_t *targets)
+{
+    (void)span;
+    return pick_span(shape, 1, targets);
+}
+
+// Function to pick a walk of the whole memory map
+static size_t pick_walk(shape_t *shape, uint64_t span, target_t *targets)
+{
+    (void)shape;
+    (void)span;
+    targets[0].address = targets[0].size = 0;
+    return 1;
+}
+
+// Functions to run the benchmarked primitives on a target, and to undo them
+static vma_status_t op_alloc(shape_t *shape, const target_t *target)
+{
+    return vma_alloc_block(shape->arena, target->address, target->size);
+}
+
+static vma_status_t op_free(shape_t *shape, const target_t *target)
+{
+    return vma_free_block(shape->arena, target->address);
+}
+
+static vma_status_t op_read(shape_t *shape, const target_t *target)
+{
+    uint64_t done = 0;
+
+    return vma_read(shape->arena, target->address, target->size, buffer, &done);
+}
+
+static vma_status_t op_write(shape_t *shape, const target_t *target)
+{
+    uint64_t done = 0;
+
+    return vma_write(shape->arena, target->address, target->size, payload, &done);
+}
+
+static vma_status_t op_protect(shape_t *shape, const target_t *target)
+{
+    return vma_mprotect(shape->arena, target->address,
+                        VMA_PROT_READ | VMA_PROT_WRITE | VMA_PROT_EXEC);
+}
+
+static vma_status_t op_unprotect(shape_t *shape, const target_t *target)
+{
+    return vma_mprotect(shape->arena, target->address, VMA_PROT_READ | VMA_PROT_WRITE);
+}
+
+static vma_status_t op_pmap(shape_t *shape, const target_t *target)
+{
+    vma_pmap_iter_t iter;
+    vma_record_t record;
+    uint64_t records = 0;
+
+    (void)target;
+    vma_pmap_begin(shape->arena, &iter);
+    while (vma_pmap_next(&iter, &record))
+        records++;
+    return records > 0 ? VMA_OK : VMA_ERR_INVALID_ADDRESS;
+}
+
+// Every benchmarked case; the read and write ones are also swept over the span of an access
+static const bench_case_t cases[] = {
+    {"alloc_block", "merge_left", 1, UINT64_MAX, 0, pick_merge_left, op_alloc, op_free},
+    {"alloc_block", "merge_right", 1, UINT64_MAX, 0, pick_merge_right, op_alloc, op_free},
+    {"alloc_block", "merge_both", 1, UINT64_MAX, 0, pick_merge_both, op_alloc, op_free},
+    {"free_block", "whole", 1, 1, 0, pick_head, op_free, op_alloc},
+    {"free_block", "head", 3, UINT64_MAX, 0, pick_head, op_free, op_alloc},
+    {"free_block", "tail", 3, UINT64_MAX, 0, pick_tail, op_free, op_alloc},
+    {"free_block", "middle", 3, UINT64_MAX, 0, pick_middle, op_free, op_alloc},
+    {"write", "span", 1, UINT64_MAX, 1, pick_span, op_write, NULL},
+    {"read", "span", 1, UINT64_MAX, 1, pick_span, op_read, NULL},
+    {"mprotect", "lookup", 1, UINT64_MAX, 0, pick_miniblock, op_protect, op_unprotect},
+    {"pmap", "walk", 1, UINT64_MAX, 0, pick_walk, op_pmap, NULL},
+};
+
+// Function to time a case on a shape; returns the best nanoseconds per operation, or a
+// negative number if an operation failed. *access is set to the bytes each operation covers.
+static double run_case(shape_t *shape, const bench_case_t *bench, const uint64_t span, size_t *ops,
+                       uint64_t *access)
+{
+    static target_t targets[BENCH_BATCH];
+    double best = -1;
+    size_t count = 0;
+    size_t round_ops = 0;
+    uint64_t start = 0;
+    uint64_t elapsed = 0;
+    int failed = 0;
+
+    *ops = 0;
+    for (int round = 0; round < BENCH_ROUNDS; round++)
+    {
+        elapsed = 0;
+        round_ops = 0;
+        while (elapsed < BENCH_ROUND_NS)
+        {
+            count = bench->pick(shape, span, targets);
+            if (count == 0)
+                return -1;
+            *access = targets[0].size;
+
+            start = now_ns();
+            for (size_t i = 0; i < count; i++)
+                failed |= bench->op(shape, &targets[i]) != VMA_OK;
+            elapsed += now_ns() - start;
+            round_ops += count;
+
+            for (size_t i = 0; bench->undo != NULL && i < count; i++)
+                failed |= bench->undo(shape, &targets[i]) != VMA_OK;
+            if (failed)
+                return -1;
+        }
+        if (best < 0 || (double)elapsed / round_ops < best)
+            best = (double)elapsed / round_ops;
+        *ops += round_ops;
+    }
+    return best;
+}
+
+// Function to load a CSV written by an earlier run, returns 0 if it cannot be read or the
+// host runs out of memory holding it
+static int load_baseline(baseline_t *baseline, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    char line[256];
+    char *commas[6];
+    size_t found = 0;
+    size_t capacity = 0;
+    baseline_row_t *row = NULL;
+    baseline_row_t *grown = NULL;
+
+    if (file == NULL)
+        return 0;
+
+    // Rows are keyed by their first five fields, the timing is the seventh
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        found = 0;
+        for (char *c = line; *c != '\0' && found < 6; c++)
+            if (*c == ',')
+                commas[found++] = c;
+        if (found < 6 || strncmp(line, "primitive,", 10) == 0 ||
+            (size_t)(commas[4] - line) >= sizeof(row->key))
+            continue;
+
+        if (baseline->count == capacity)
+        {
+            capacity = capacity > 0 ? 2 * capacity : 64;
+            grown = realloc(baseline->rows, capacity * sizeof(baseline_row_t));
+            if (grown == NULL)
+            {
+                free(baseline->rows);
+                baseline->rows = NULL;
+                baseline->count = 0;
+                fclose(file);
+                return 0;
+            }
+            baseline->rows = grown;
+        }
+        row = &baseline->rows[baseline->count++];
+        memcpy(row->key, line, commas[4] - line);
+        row->key[commas[4] - line] = '\0';
+        row->ns_per_op = strtod(commas[5] + 1, NULL);
+    }
+    fclose(file);
+    return 1;
+}
+
+// Function to find the baseline timing of a row, returns a negative number if it has none
+static double find_baseline(const baseline_t *baseline, const char *key)
+{
+    for (size_t i = 0; i < baseline->count; i++)
+        if (strcmp(baseline->rows[i].key, key) == 0)
+            return baseline->rows[i].ns_per_op;
+    return -1;
+}
+
+// Function to run every case on every shape of the sweep, printing a CSV row for each
+static int run_sweep(const uint64_t *block_counts, const size_t block_sweeps,
+                     const uint64_t *miniblock_counts, const size_t miniblock_sweeps,
+                     const uint64_t *spans, const size_t span_sweeps, baseline_t *baseline)
+{
+    shape_t shape;
+    const bench_case_t *bench = NULL;
+    char key[128];
+    double ns_per_op = 0;
+    double old = 0;
+    size_t ops = 0;
+    uint64_t access = 0;
+
+    printf("primitive,case,blocks,miniblocks,access_bytes,ops,ns_per_op%s\n",
+           baseline != NULL ? ",baseline_ns_per_op,ratio" : "");
+    for (size_t b = 0; b < block_sweeps; b++)
+    {
+        for (size_t m = 0; m < miniblock_sweeps; m++)
+        {
+            if (!create_shape(&shape, block_counts[b], miniblock_counts[m]))
+            {
+                fprintf(stderr, "Could not build %" PRIu64 " blocks of %" PRIu64 " miniblocks.\n",
+                        block_counts[b], miniblock_counts[m]);
+                return 1;
+            }
+
+            for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+            {
+                bench = &cases[c];
+                if (shape.miniblocks < bench->min_miniblocks || shape.miniblocks > bench->max_miniblocks)
+                    continue;
+
+                // Only reads and writes sweep the span, the rest touch a miniblock at a time
+                for (size_t s = 0; s < (bench->spans ? span_sweeps : 1); s++)
+                {
+                    if (bench->spans && spans[s] > shape.miniblocks)
+                        break;
+
+                    ns_per_op = run_case(&shape, bench, bench->spans ? spans[s] : 1, &ops, &access);
+                    if (ns_per_op < 0)
+                    {
+                        fprintf(stderr, "%s %s failed.\n", bench->primitive, bench->name);
+                        vma_dealloc_arena(shape.arena);
+                        return 1;
+                    }
+
+                    snprintf(key, sizeof(key), "%s,%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64,
+                             bench->primitive, bench->name, shape.blocks, shape.miniblocks, access);
+                    printf("%s,%zu,%.1f", key, ops, ns_per_op);
+                    if (baseline != NULL)
+                    {
+                        old = find_baseline(baseline, key);
+                        if (old > 0)
+                            printf(",%.1f,%.2f", old, ns_per_op / old);
+                        else
+                            printf(",,");
+                        if (old > 0 && ns_per_op / old > baseline->tolerance)
+                        {
+                            fprintf(stderr, "Regression: %s takes %.1f ns, %.2f times the baseline.\n",
+                                    key, ns_per_op, ns_per_op / old);
+                            baseline->regressions++;
+                        }
+                    }
+                    printf("\n");
+                    fflush(stdout);
+                }
+            }
+            vma_dealloc_arena(shape.arena);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const uint64_t full_blocks[] = {64, 1024, 16384};
+    static const uint64_t quick_blocks[] = {64, 1024};
+    static const uint64_t miniblock_counts[] = {1, 4, 32};
+    static const uint64_t spans[] = {1, 4, 32};
+    baseline_t baseline = {NULL, 0, BENCH_TOLERANCE, 0};
+    const char *baseline_path = NULL;
+    int quick = 0;
+    int result = 0;
+
+    // ./vma_bench [--quick] [--baseline <csv>] [--tolerance <ratio>]
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--quick") == 0)
+            quick = 1;
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+            baseline_path = argv[++i];
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+            baseline.tolerance = strtod(argv[++i], NULL);
+        else
+        {
+            fprintf(stderr, "Usage: %s [--quick] [--baseline <csv>] [--tolerance <ratio>]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (baseline_path != NULL && !load_baseline(&baseline, baseline_path))
+    {
+        fprintf(stderr, "%s could not be read.\n", baseline_path);
+        return 2;
+    }
+
+    for (size_t i = 0; i < sizeof(payload); i++)
+        payload[i] = (uint8_t)(i * 31 + 7);
+
+    result = run_sweep(quick ? quick_blocks : full_blocks,
+                       quick ? sizeof(quick_blocks) / sizeof(uint64_t) : sizeof(full_blocks) / sizeof(uint64_t),
+                       miniblock_counts, sizeof(miniblock_counts) / sizeof(uint64_t),
+                       spans, sizeof(spans) / sizeof(uint64_t),
+                       baseline_path != NULL ? &baseline : NULL);
+
+    free(baseline.rows);
+    if (result == 0 && baseline.regressions > 0)
+    {
+        fprintf(stderr, "%d rows regressed past %.2f times the baseline.\n", baseline.regressions,
+                baseline.tolerance);
+        result = 1;
+    }
+    return result;
+}
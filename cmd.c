@@ -0,0 +1,1034 @@
+#define _POSIX_C_SOURCE 200809L // For getc_unlocked
+#include "cmd.h"                // Include the header file for command parsing and execution
+
+#include <ctype.h>
+
+// Definition of a cursor over the bytes of a command being parsed
+typedef struct
+{
+    const char *buf;
+    size_t len;
+    size_t pos;
+    int eof; // No more bytes will follow the buffer
+} cursor_t;
+
+// Function to skip whitespace, like the leading directives of scanf do
+static void skip_spaces(cursor_t *cur)
+{
+    while (cur->pos < cur->len && isspace((unsigned char)cur->buf[cur->pos]))
+        cur->pos++;
+}
+
+// Function to read a whitespace-delimited token (scanf "%s"), returns 0 if more input is needed
+static int read_token(cursor_t *cur, char *token, size_t max)
+{
+    size_t start = 0;
+    size_t size = 0;
+
+    skip_spaces(cur);
+    start = cur->pos;
+    while (cur->pos < cur->len && !isspace((unsigned char)cur->buf[cur->pos]))
+        cur->pos++;
+
+    // The token may continue in bytes that have not arrived yet
+    if (cur->pos == cur->len && !cur->eof)
+        return 0;
+
+    size = cur->pos - start;
+    if (size >= max)
+        size = max - 1;
+    memcpy(token, cur->buf + start, size);
+    token[size] = '\0';
+    return 1;
+}
+
+// Function to read a signed decimal number (scanf "%ld"), returns 0 if more input is needed
+static int read_number(cursor_t *cur, uint64_t *value)
+{
+    int negative = 0;
+    uint64_t result = 0;
+
+    skip_spaces(cur);
+    if (cur->pos < cur->len && (cur->buf[cur->pos] == '-' || cur->buf[cur->pos] == '+'))
+        negative = cur->buf[cur->pos++] == '-';
+
+    while (cur->pos < cur->len && isdigit((unsigned char)cur->buf[cur->pos]))
+        result = result * 10 + (cur->buf[cur->pos++] - '0');
+
+    if (cur->pos == cur->len && !cur->eof)
+        return 0;
+
+    *value = negative ? -result : result;
+    return 1;
+}
+
+// Function to consume the single separator character after a number (scanf "%c")
+static int read_separator(cursor_t *cur)
+{
+    if (cur->pos == cur->len)
+        return cur->eof;
+    cur->pos++;
+    return 1;
+}
+
+// Function to parse one command from buf, setting *used to the bytes it took.
+// Returns PARSE_NEED_MORE if the command is not complete yet and eof is not set.
+int parse_command(const char *buf, size_t len, int eof, int flags,
+                  command_t *cmd, size_t *used)
+{
+    cursor_t cur = {buf, len, 0, eof};
+    char token[255];
+    char string[100];
+    size_t line = 0;
+
+    memset(cmd, 0, sizeof(command_t));
+    if (!read_token(&cur, token, sizeof(token)))
+        return PARSE_NEED_MORE;
+
+    if (token[0] == '\0')
+    {
+        cmd->type = CMD_END;
+    }
+    else if ((flags & (PARSE_FIRST | PARSE_ARENAS)) && strcmp(token, "ALLOC_ARENA_FILE") == 0)
+    {
+        // The arena size is followed by the path of its backing file
+        cmd->type = CMD_ALLOC_ARENA_FILE;
+        if (!read_number(&cur, &cmd->size) || !read_token(&cur, cmd->path, sizeof(cmd->path)))
+            return PARSE_NEED_MORE;
+    }
+    else if ((flags & PARSE_FIRST) ||
+             ((flags & PARSE_ARENAS) && strcmp(token, "ALLOC_ARENA") == 0))
+    {
+        // Whatever the first word is, it is followed by the arena size
+        cmd->type = CMD_ALLOC_ARENA;
+        if (!read_number(&cur, &cmd->size) || !read_separator(&cur))
+            return PARSE_NEED_MORE;
+    }
+    else if (strcmp(token, "SELECT_ARENA") == 0 || strcmp(token, "DESTROY_ARENA") == 0)
+    {
+        cmd->type = strcmp(token, "SELECT_ARENA") == 0 ? CMD_SELECT_ARENA : CMD_DESTROY_ARENA;
+        if (!read_token(&cur, cmd->name, sizeof(cmd->name)))
+            return PARSE_NEED_MORE;
+    }
+    else if (strcmp(token, "CREATE_ARENA") == 0)
+    {
+        // The name is followed by the arena size
+        cmd->type = CMD_CREATE_ARENA;
+        if (!read_token(&cur, cmd->name, sizeof(cmd->name)) || !read_number(&cur, &cmd->size) ||
+            !read_separator(&cur))
+            return PARSE_NEED_MORE;
+    }
+    else if (strcmp(token, "LIST_ARENAS") == 0)
+    {
+        cmd->type = CMD_LIST_ARENAS;
+    }
+    else if (strcmp(token, "ALLOC_BLOCK") == 0 || strcmp(token, "READ") == 0 ||
+             strcmp(token, "WRITE") == 0)
+    {
+        cmd->type = token[0] == 'A' ? CMD_ALLOC_BLOCK : token[0] == 'R' ? CMD_READ : CMD_WRITE;
+        if (!read_number(&cur, &cmd->address) || !read_separator(&cur) ||
+            !read_number(&cur, &cmd->size) || !read_separator(&cur))
+            return PARSE_NEED_MORE;
+
+        // The payload of a write is the next size raw bytes
+        if (cmd->type == CMD_WRITE)
+        {
+            if (cur.len - cur.pos < cmd->size && !eof)
+                return PARSE_NEED_MORE;
+
+            // Only the bytes that arrived are kept, so the size never decides the allocation;
+            // data stays NULL if the host is out of memory, and the payload is skipped anyway
+            cmd->length = cur.len - cur.pos < cmd->size ? cur.len - cur.pos : cmd->size;
+            cmd->data = malloc(cmd->length > 0 ? cmd->length : 1);
+            if (cmd->data != NULL)
+                memcpy(cmd->data, cur.buf + cur.pos, cmd->length);
+            cur.pos += cmd->length;
+        }
+    }
+    else if (strcmp(token, "FREE_BLOCK") == 0)
+    {
+        cmd->type = CMD_FREE_BLOCK;
+        if (!read_number(&cur, &cmd->address) || !read_separator(&cur))
+            return PARSE_NEED_MORE;
+    }
+    else if (strcmp(token, "PMAP") == 0)
+    {
+        cmd->type = CMD_PMAP;
+    }
+    else if (strcmp(token, "PMAP_DIFF") == 0)
+    {
+        cmd->type = CMD_PMAP_DIFF;
+    }
+    else if (strcmp(token, "MPROTECT") == 0)
+    {
+        cmd->type = CMD_MPROTECT;
+        if (!read_number(&cur, &cmd->address) || !read_separator(&cur))
+            return PARSE_NEED_MORE;
+
+        // The permissions are the rest of the line, read like fgets with a 100 byte buffer
+        while (cur.pos + line < cur.len && line < sizeof(string) - 1 &&
+               cur.buf[cur.pos + line] != '\n')
+            line++;
+        if (cur.pos + line < cur.len && line < sizeof(string) - 1)
+            line++; // Keep the newline, as fgets does
+        else if (cur.pos + line == cur.len && line < sizeof(string) - 1 && !eof)
+            return PARSE_NEED_MORE;
+
+        memcpy(string, cur.buf + cur.pos, line);
+        string[line] = '\0';
+        cur.pos += line;
+        cmd->perm = mprotect_aux(string);
+    }
+    else if (strcmp(token, "STATS") == 0)
+    {
+        cmd->type = CMD_STATS;
+    }
+    else if (strcmp(token, "FLUSH") == 0)
+    {
+        cmd->type = CMD_FLUSH;
+    }
+    else if (strcmp(token, "HEAT_SAMPLE") == 0)
+    {
+        cmd->type = CMD_HEAT_SAMPLE;
+        if (!read_number(&cur, &cmd->size) || !read_separator(&cur) ||
+            !read_number(&cur, &cmd->address) || !read_separator(&cur))
+            return PARSE_NEED_MORE;
+    }
+    else if (strcmp(token, "PAGED") == 0)
+    {
+        cmd->type = CMD_PAGED;
+        if (!read_number(&cur, &cmd->size) || !read_separator(&cur))
+            return PARSE_NEED_MORE;
+    }
+    else if (strcmp(token, "MALLOC") == 0)
+    {
+        cmd->type = CMD_MALLOC;
+        if (!read_number(&cur, &cmd->size) || !read_separator(&cur))
+            return PARSE_NEED_MORE;
+    }
+    else if (strcmp(token, "MFREE") == 0)
+    {
+        cmd->type = CMD_MFREE;
+        if (!read_number(&cur, &cmd->address) || !read_separator(&cur) ||
+            !read_number(&cur, &cmd->size) || !read_separator(&cur))
+            return PARSE_NEED_MORE;
+    }
+    else if (strcmp(token, "SWAP") == 0)
+    {
+        cmd->type = CMD_SWAP;
+        if (!read_number(&cur, &cmd->size) || !read_separator(&cur))
+            return PARSE_NEED_MORE;
+    }
+    else if (strcmp(token, "DEDUP") == 0)
+    {
+        cmd->type = CMD_DEDUP;
+    }
+    else if (strcmp(token, "HEATMAP") == 0)
+    {
+        cmd->type = CMD_HEATMAP;
+        if (!read_number(&cur, &cmd->size) || !read_separator(&cur))
+            return PARSE_NEED_MORE;
+    }
+    else if (strcmp(token, "DEALLOC_ARENA") == 0)
+    {
+        cmd->type = CMD_DEALLOC_ARENA;
+    }
+    else
+    {
+        cmd->type = CMD_INVALID;
+    }
+
+    *used = cur.pos;
+    return PARSE_DONE;
+}
+
+// Function to create a command reader over a stream, returns NULL if the host is out of memory
+cmd_input_t *create_cmd_input(FILE *stream)
+{
+    cmd_input_t *in = malloc(sizeof(cmd_input_t));
+
+    if (in == NULL)
+        return NULL;
+    in->stream = stream;
+    in->cap = 1 << 16;
+    in->buf = malloc(in->cap);
+    if (in->buf == NULL)
+    {
+        free(in);
+        return NULL;
+    }
+    in->len = in->pos = 0;
+    in->eof = 0;
+    in->first = 1;
+    return in;
+}
+
+// Function to read more bytes from the stream, stopping after a newline so interactive use works
+static void refill_cmd_input(cmd_input_t *in)
+{
+    char *grown = NULL;
+    int c = 0;
+
+    // Drop the bytes already parsed, and grow the buffer if it is still full
+    if (in->pos > 0)
+    {
+        memmove(in->buf, in->buf + in->pos, in->len - in->pos);
+        in->len -= in->pos;
+        in->pos = 0;
+    }
+    if (in->len == in->cap)
+    {
+        // A line too long for the host ends the input, so it is parsed as far as it got
+        grown = realloc(in->buf, 2 * in->cap);
+        if (grown == NULL)
+        {
+            in->eof = 1;
+            return;
+        }
+        in->buf = grown;
+        in->cap *= 2;
+    }
+
+    while (in->len < in->cap)
+    {
+        c = getc_unlocked(in->stream);
+        if (c == EOF)
+        {
+            in->eof = 1;
+            break;
+        }
+        in->buf[in->len++] = c;
+        if (c == '\n')
+            break;
+    }
+}
+
+// Function to get the next command from the reader, returns 0 once the input is over
+int next_command(cmd_input_t *in, command_t *cmd)
+{
+    size_t used = 0;
+
+    while (parse_command(in->buf + in->pos, in->len - in->pos, in->eof,
+                         in->first ? PARSE_FIRST : 0, cmd, &used) == PARSE_NEED_MORE)
+        refill_cmd_input(in);
+
+    in->pos += used;
+    in->first = 0;
+    return cmd->type != CMD_END;
+}
+
+// Function to delete a command reader (the stream itself stays open)
+void delete_cmd_input(cmd_input_t *in)
+{
+    free(in->buf);
+    free(in);
+}
+
+// Function to parse the input string and convert permission string to integer representation
+uint8_t mprotect_aux(char *string)
+{
+    uint8_t result = VMA_PROT_NONE;
+    char *p = strtok(string, "\n |"); // Tokenize the input string using space and newline characters
+
+    // Iterate through the tokens and convert permission strings to integer representation
+    while (p)
+    {
+        // Check each token and update the result based on the permission string
+        if (strcmp(p, "PROT_READ") == 0)
+            result |= VMA_PROT_READ;
+        if (strcmp(p, "PROT_WRITE") == 0)
+            result |= VMA_PROT_WRITE;
+        if (strcmp(p, "PROT_EXEC") == 0)
+            result |= VMA_PROT_EXEC;
+
+        p = strtok(NULL, "\n |"); // Move to the next token
+    }
+    return result; // Return the integer representation of the permissions
+}
+
+// Function to print the outcome of ALLOC_BLOCK
+static void text_alloc_block(arena_t *arena, command_t *cmd, strbuf_t *out)
+{
+    vma_status_t status = vma_alloc_block(arena, cmd->address, cmd->size);
+
+    if (status == VMA_ERR_ADDRESS_OUTSIDE)
+        strbuf_printf(out, "The allocated address is outside the size of the arena\n");
+    else if (status == VMA_ERR_END_OUTSIDE)
+        strbuf_printf(out, "The end address is past the size of the arena\n");
+    else if (status == VMA_ERR_ALREADY_ALLOCATED)
+        strbuf_printf(out, "This zone was already allocated.\n");
+    else if (status != VMA_OK)
+        strbuf_printf(out, "%s.\n", vma_strerror(status));
+}
+
+// Function to check whether an address is a free object held by the size-class caches
+static int cached_object(arena_t *arena, const uint64_t address)
+{
+    vma_central_t *central = vma_central_get(arena);
+
+    return central != NULL && vma_cache_holds(central, address);
+}
+
+// Function to print the outcome of FREE_BLOCK
+static void text_free_block(arena_t *arena, command_t *cmd, strbuf_t *out)
+{
+    vma_status_t status = VMA_ERR_INVALID_ADDRESS;
+
+    // Free objects waiting in the size-class caches are not the caller's to free
+    if (!cached_object(arena, cmd->address))
+        status = vma_free_block(arena, cmd->address);
+    if (status == VMA_ERR_NO_MEMORY)
+        strbuf_printf(out, "%s.\n", vma_strerror(status));
+    else if (status != VMA_OK)
+        strbuf_printf(out, "Invalid address for free.\n");
+}
+
+// Function to print the data read by READ, preceded by a warning if the block ended first
+static void text_read(arena_t *arena, command_t *cmd, strbuf_t *out)
+{
+    char warning[128];
+    int warning_len = 0;
+    uint64_t size = 0;
+    uint64_t done = 0;
+    vma_status_t status = vma_block_remaining(arena, cmd->address, &size);
+
+    if (status == VMA_ERR_INVALID_ADDRESS)
+    {
+        strbuf_printf(out, "Invalid address for read.\n");
+        return;
+    }
+
+    // Read straight into the output buffer, with room left for the warning and the newline
+    if (size > cmd->size)
+        size = cmd->size;
+    if (size > SIZE_MAX - sizeof(warning) || !strbuf_reserve(out, size + sizeof(warning)))
+    {
+        strbuf_printf(out, "%s.\n", vma_strerror(VMA_ERR_NO_MEMORY));
+        return;
+    }
+    status = vma_read(arena, cmd->address, size, out->data + out->len, &done);
+    if (status == VMA_ERR_PERMISSION)
+    {
+        strbuf_printf(out, "Invalid permissions for read.\n");
+        return;
+    }
+    if (status != VMA_OK)
+    {
+        strbuf_printf(out, "%s.\n", vma_strerror(status));
+        return;
+    }
+
+    // The warning goes before the data, so slide the data over to make room for it
+    if (done < cmd->size)
+    {
+        warning_len = snprintf(warning, sizeof(warning),
+                               "Warning: size was bigger than the block size. Reading %" PRIu64 " characters.\n",
+                               done);
+        memmove(out->data + out->len + warning_len, out->data + out->len, done);
+        memcpy(out->data + out->len, warning, warning_len);
+        out->len += warning_len;
+    }
+    out->len += done;
+    strbuf_append(out, "\n", 1);
+}
+
+// Function to print the outcome of WRITE
+static void text_write(arena_t *arena, command_t *cmd, strbuf_t *out)
+{
+    static const int8_t zeroes[4096];
+    uint64_t remaining = 0;
+    uint64_t done = 0;
+    uint64_t part = 0;
+    uint64_t chunk = 0;
+    vma_status_t status = VMA_OK;
+
+    if (cmd->data == NULL)
+    {
+        strbuf_printf(out, "%s.\n", vma_strerror(VMA_ERR_NO_MEMORY));
+        return;
+    }
+
+    status = vma_write(arena, cmd->address, cmd->length, cmd->data, &done);
+
+    // A payload cut short by the end of the input goes on with zeroes, up to the end of the block
+    if (status == VMA_OK && done == cmd->length && done < cmd->size &&
+        vma_block_remaining(arena, cmd->address, &remaining) == VMA_OK)
+    {
+        if (remaining > cmd->size)
+            remaining = cmd->size;
+        while (status == VMA_OK && done < remaining)
+        {
+            chunk = remaining - done < sizeof(zeroes) ? remaining - done : sizeof(zeroes);
+            status = vma_write(arena, cmd->address + done, chunk, zeroes, &part);
+            done += part;
+        }
+    }
+
+    if (status == VMA_ERR_INVALID_ADDRESS)
+        strbuf_printf(out, "Invalid address for write.\n");
+    else if (status == VMA_ERR_PERMISSION)
+        strbuf_printf(out, "Invalid permissions for write.\n");
+    else if (status != VMA_OK)
+        strbuf_printf(out, "%s.\n", vma_strerror(status));
+    else if (done < cmd->size)
+        strbuf_printf(out, "Warning: size was bigger than the block size. Writing %" PRIu64 " characters.\n",
+                      done);
+}
+
+// Function to print the totals at the top of the memory map, kept up to date by every change
+static void text_totals(const arena_t *arena, strbuf_t *out)
+{
+    vma_stats_t stats;
+
+    vma_stats(arena, &stats);
+    strbuf_printf(out, "Total memory: 0x%" PRIX64 " bytes\n", stats.arena_size);
+    strbuf_printf(out, "Free memory: 0x%" PRIX64 " bytes\n", stats.arena_size - stats.allocated_size);
+    strbuf_printf(out, "Number of allocated blocks: %zu\n", stats.block_count);
+    strbuf_printf(out, "Number of allocated miniblocks: %zu\n", stats.miniblock_count);
+}
+
+// Function to print the memory map (block addresses, miniblock addresses, permissions)
+static void text_pmap(const arena_t *arena, strbuf_t *out)
+{
+    vma_pmap_iter_t iter;
+    vma_record_t record;
+    vma_page_stats_t pages;
+    vma_heat_info_t heat;
+    size_t open_block = 0; // Index of the block whose end line is still due
+    int paged = vma_page_stats(arena, &pages) == VMA_OK;
+    int sampled = vma_heat_get(arena, &heat) == VMA_OK;
+
+    text_totals(arena, out);
+
+    vma_pmap_begin(arena, &iter);
+    while (vma_pmap_next(&iter, &record))
+    {
+        if (record.type == VMA_RECORD_BLOCK)
+        {
+            if (open_block)
+                strbuf_printf(out, "Block %zu end\n", open_block);
+            open_block = record.index;
+            strbuf_printf(out, "\nBlock %zu begin\n", record.index);
+            strbuf_printf(out, "Zone: 0x%" PRIX64 " - 0x%" PRIX64 "\n", record.start_address,
+                          record.end_address);
+
+            // With paged storage, show how much of the block is held in memory
+            if (paged)
+                strbuf_printf(out, "Stored: %" PRIu64 " of %" PRIu64 " bytes (%.2f%%)\n",
+                              record.stored_size, record.end_address - record.start_address,
+                              record.end_address > record.start_address
+                                  ? 100.0 * record.stored_size / (record.end_address - record.start_address)
+                                  : 0.0);
+        }
+        else
+        {
+            // Permissions are shown as R, W and X, or - when missing
+            strbuf_printf(out, "Miniblock %zu:\t\t0x%" PRIX64 "\t\t-\t\t0x%" PRIX64 "\t\t| %c%c%c",
+                          record.index, record.start_address, record.end_address,
+                          record.perm & VMA_PROT_READ ? 'R' : '-',
+                          record.perm & VMA_PROT_WRITE ? 'W' : '-',
+                          record.perm & VMA_PROT_EXEC ? 'X' : '-');
+
+            // While sampling is on, the heat of each miniblock follows its permissions
+            if (sampled)
+                strbuf_printf(out, "\t\t| %" PRIu64 " reads (%" PRIu64 " bytes), %" PRIu64 " writes (%" PRIu64 " bytes)",
+                              record.heat.reads, record.heat.read_bytes, record.heat.writes,
+                              record.heat.write_bytes);
+            strbuf_append(out, "\n", 1);
+        }
+    }
+    if (open_block)
+        strbuf_printf(out, "Block %zu end\n", open_block);
+}
+
+// Function to print the changes to the memory map since the last PMAP or PMAP_DIFF
+static void text_pmap_diff(arena_t *arena, strbuf_t *out)
+{
+    static const char *kinds[] = {"Removed", "Added", "Resized", "Reprotected"};
+    vma_diff_t *diff = NULL;
+    size_t count = 0;
+    size_t i;
+
+    if (vma_pmap_diff(arena, &diff, &count) != VMA_OK)
+    {
+        strbuf_printf(out, "%s.\n", vma_strerror(VMA_ERR_NO_MEMORY));
+        return;
+    }
+
+    text_totals(arena, out);
+    for (i = 0; i < count; i++)
+    {
+        strbuf_printf(out, "%s %s: 0x%" PRIX64 " - 0x%" PRIX64, kinds[diff[i].kind],
+                      diff[i].type == VMA_RECORD_BLOCK ? "block" : "miniblock",
+                      diff[i].start_address, diff[i].end_address);
+        if (diff[i].type == VMA_RECORD_MINIBLOCK)
+            strbuf_printf(out, " | %c%c%c", diff[i].perm & VMA_PROT_READ ? 'R' : '-',
+                          diff[i].perm & VMA_PROT_WRITE ? 'W' : '-',
+                          diff[i].perm & VMA_PROT_EXEC ? 'X' : '-');
+
+        // Show what the entry looked like in the last map
+        if (diff[i].kind == VMA_DIFF_RESIZED)
+            strbuf_printf(out, " (was 0x%" PRIX64 " - 0x%" PRIX64 ")", diff[i].start_address,
+                          diff[i].old_end_address);
+        else if (diff[i].kind == VMA_DIFF_REPROTECTED)
+            strbuf_printf(out, " (was %c%c%c)", diff[i].old_perm & VMA_PROT_READ ? 'R' : '-',
+                          diff[i].old_perm & VMA_PROT_WRITE ? 'W' : '-',
+                          diff[i].old_perm & VMA_PROT_EXEC ? 'X' : '-');
+        strbuf_append(out, "\n", 1);
+    }
+    free(diff);
+}
+
+// Function to get the cache MALLOC and MFREE go through, creating it on first use
+static vma_thread_cache_t *command_cache(arena_t *arena)
+{
+    vma_central_t *central = vma_central_get(arena);
+
+    if (central == NULL)
+        central = vma_central_create(arena);
+    if (central == NULL)
+        return NULL;
+    if (central->main_cache == NULL)
+        central->main_cache = vma_cache_create(central);
+    return central->main_cache;
+}
+
+// Function to print the address MALLOC got, or why it got none
+static void text_malloc(arena_t *arena, command_t *cmd, strbuf_t *out)
+{
+    vma_thread_cache_t *cache = command_cache(arena);
+    uint64_t address = 0;
+    vma_status_t status = cache != NULL ? vma_cache_alloc(cache, cmd->size, &address) : VMA_ERR_NO_MEMORY;
+
+    if (status == VMA_OK)
+        strbuf_printf(out, "%" PRIu64 "\n", address);
+    else
+        strbuf_printf(out, "%s.\n", vma_strerror(status));
+}
+
+// Function to print the outcome of MFREE
+static void text_mfree(arena_t *arena, command_t *cmd, strbuf_t *out)
+{
+    vma_thread_cache_t *cache = command_cache(arena);
+    vma_status_t status = cache != NULL ? vma_cache_check(cache, cmd->address, cmd->size) : VMA_ERR_NO_MEMORY;
+
+    // Commands come from untrusted input, so the free is checked before the cache takes it
+    if (status == VMA_OK)
+        status = vma_cache_free(cache, cmd->address, cmd->size);
+
+    if (status == VMA_ERR_INVALID_ADDRESS)
+        strbuf_printf(out, "Invalid address for free.\n");
+    else if (status != VMA_OK)
+        strbuf_printf(out, "%s.\n", vma_strerror(status));
+}
+
+// Function to run a deduplication and print what it found
+static void text_dedup(arena_t *arena, strbuf_t *out)
+{
+    vma_page_stats_t before;
+    vma_page_stats_t after;
+    vma_status_t status = VMA_OK;
+
+    before.counters.scanned_pages = 0;
+    vma_page_stats(arena, &before);
+    status = vma_dedup(arena);
+    if (status == VMA_OK)
+        vma_page_stats(arena, &after);
+
+    if (status == VMA_ERR_UNSUPPORTED)
+        strbuf_printf(out, "Deduplication needs paged storage.\n");
+    else if (status != VMA_OK)
+        strbuf_printf(out, "%s.\n", vma_strerror(status));
+    else
+        strbuf_printf(out, "Pages scanned: %" PRIu64 ", pages shared: %" PRIu64 ", bytes saved: %" PRIu64 "\n",
+                      after.counters.scanned_pages - before.counters.scanned_pages,
+                      after.counters.shared_pages, after.counters.saved_bytes);
+}
+
+// Width of the longest bar of the HEATMAP histogram
+#define HEAT_BAR_WIDTH 40
+
+// Function to order miniblock records by the bytes accessed, hottest first
+static int compare_heat(const void *a, const void *b)
+{
+    const vma_record_t *left = a;
+    const vma_record_t *right = b;
+    uint64_t left_bytes = left->heat.read_bytes + left->heat.write_bytes;
+    uint64_t right_bytes = right->heat.read_bytes + right->heat.write_bytes;
+
+    if (left_bytes != right_bytes)
+        return left_bytes < right_bytes ? 1 : -1;
+    return left->start_address < right->start_address ? -1 : left->start_address > right->start_address;
+}
+
+// Function to print the count hottest miniblocks and the histogram of the address buckets
+static void text_heatmap(const arena_t *arena, uint64_t count, strbuf_t *out)
+{
+    vma_heat_info_t heat;
+    vma_stats_t stats;
+    vma_pmap_iter_t iter;
+    vma_record_t *records = NULL;
+    size_t record_count = 0;
+    uint64_t max_bytes = 0;
+    uint64_t bytes = 0;
+    uint64_t bar = 0;
+    size_t i;
+
+    if (vma_heat_get(arena, &heat) != VMA_OK)
+    {
+        strbuf_printf(out, "Access sampling is off.\n");
+        return;
+    }
+
+    // Gather the miniblocks that were accessed, then sort them by heat
+    vma_stats(arena, &stats);
+    records = malloc((stats.miniblock_count + 1) * sizeof(vma_record_t));
+    if (records == NULL)
+    {
+        strbuf_printf(out, "%s.\n", vma_strerror(VMA_ERR_NO_MEMORY));
+        return;
+    }
+    vma_pmap_begin(arena, &iter);
+    while (vma_pmap_next(&iter, &records[record_count]))
+    {
+        if (records[record_count].type == VMA_RECORD_MINIBLOCK &&
+            records[record_count].heat.reads + records[record_count].heat.writes > 0)
+            record_count++;
+    }
+    qsort(records, record_count, sizeof(vma_record_t), compare_heat);
+    if (count > record_count)
+        count = record_count;
+
+    strbuf_printf(out, "Sampling 1 in %" PRIu32 " accesses\n", heat.sample_rate);
+    strbuf_printf(out, "Hot ranges:\n");
+    for (i = 0; i < count; i++)
+        strbuf_printf(out, "%zu. 0x%" PRIX64 " - 0x%" PRIX64 ": %" PRIu64 " reads (%" PRIu64 " bytes), %" PRIu64 " writes (%" PRIu64 " bytes)\n",
+                      i + 1, records[i].start_address, records[i].end_address, records[i].heat.reads,
+                      records[i].heat.read_bytes, records[i].heat.writes, records[i].heat.write_bytes);
+    free(records);
+
+    // The bars of the histogram are scaled to the hottest bucket
+    for (i = 0; i < heat.bucket_count; i++)
+    {
+        bytes = heat.buckets[i].read_bytes + heat.buckets[i].write_bytes;
+        if (bytes > max_bytes)
+            max_bytes = bytes;
+    }
+    strbuf_printf(out, "Buckets of 0x%" PRIX64 " bytes:\n", heat.bucket_size);
+    for (i = 0; i < heat.bucket_count; i++)
+    {
+        bytes = heat.buckets[i].read_bytes + heat.buckets[i].write_bytes;
+        strbuf_printf(out, "0x%" PRIX64 "\t%" PRIu64 "\t|", i * heat.bucket_size, bytes);
+        for (bar = max_bytes > 0 ? bytes * HEAT_BAR_WIDTH / max_bytes : 0; bar > 0; bar--)
+            strbuf_append(out, "#", 1);
+        strbuf_append(out, "\n", 1);
+    }
+}
+
+// Function to print how much host memory the arena's metadata takes
+static void text_stats(const arena_t *arena, strbuf_t *out)
+{
+    vma_stats_t stats;
+    vma_cache_stats_t cache;
+    vma_page_stats_t pages;
+    vma_central_t *central = vma_central_get(arena);
+
+    vma_stats(arena, &stats);
+#ifdef VMA_COMPACT
+    strbuf_printf(out, "Layout: compact\n");
+#else
+    strbuf_printf(out, "Layout: default\n");
+#endif
+    strbuf_printf(out, "Backing: %s\n", vma_file_backed(arena) ? "file" : "memory");
+    strbuf_printf(out, "Miniblock node size: %zu bytes\n", stats.miniblock_node_size);
+    strbuf_printf(out, "Metadata: %zu bytes\n", stats.metadata_size);
+    strbuf_printf(out, "Miniblock pool: %zu bytes reserved\n", stats.pool_size);
+    if (stats.miniblock_count > 0)
+        strbuf_printf(out, "Metadata per miniblock: %.2f bytes\n",
+                      (double)stats.metadata_size / stats.miniblock_count);
+
+    // Size-class front end, once MALLOC has been used
+    if (central != NULL)
+    {
+        vma_cache_stats(central, &cache);
+        strbuf_printf(out, "Caches: %zu, hits: %" PRIu64 ", misses: %" PRIu64 " (%.2f%% hit rate), large: %" PRIu64 "\n",
+                      cache.cache_count, cache.hits, cache.misses,
+                      cache.hits + cache.misses > 0 ? 100.0 * cache.hits / (cache.hits + cache.misses) : 0.0,
+                      cache.large);
+        strbuf_printf(out, "Cached: %" PRIu64 " bytes in thread caches, %" PRIu64 " central, %" PRIu64 " carved\n",
+                      cache.thread_bytes, cache.central_bytes, cache.carved_bytes);
+    }
+
+    // Paged storage, by page state
+    if (vma_page_stats(arena, &pages) == VMA_OK)
+    {
+        strbuf_printf(out, "Pages: %" PRIu64 " zero, %" PRIu64 " fill, %" PRIu64 " raw, %" PRIu64 " packed, %" PRIu64 " shared\n",
+                      pages.counters.zero_pages, pages.counters.fill_pages,
+                      pages.counters.raw_pages, pages.counters.packed_pages,
+                      pages.counters.shared_pages);
+        strbuf_printf(out, "Page data: %" PRIu64 " bytes stored, %" PRIu64 " hot\n",
+                      pages.counters.stored_bytes, pages.hot_bytes);
+        strbuf_printf(out, "Compressions: %" PRIu64 ", decompressions: %" PRIu64 "\n",
+                      pages.counters.compressions, pages.counters.decompressions);
+        strbuf_printf(out, "Deduplication: %" PRIu64 " pages scanned, %" PRIu64 " bytes saved\n",
+                      pages.counters.scanned_pages, pages.counters.saved_bytes);
+        if (pages.swapping)
+        {
+            strbuf_printf(out, "Swap: %" PRIu64 " pages swapped, %" PRIu64 " bytes resident limit\n",
+                          pages.counters.swapped_pages, pages.resident_limit);
+            strbuf_printf(out, "Faults: %" PRIu64 ", evictions: %" PRIu64 ", swapped in: %" PRIu64 " bytes, swapped out: %" PRIu64 " bytes\n",
+                          pages.counters.faults, pages.counters.evictions,
+                          pages.counters.swap_in_bytes, pages.counters.swap_out_bytes);
+        }
+    }
+}
+
+// Function to run one command against the arena, appending its output to out.
+// Returns 0 once the arena has been deallocated and no more commands should run.
+int execute_command(arena_t **arena, command_t *cmd, strbuf_t *out)
+{
+    // Nothing but the arena commands can run once allocating the arena has failed
+    if (*arena == NULL && cmd->type != CMD_ALLOC_ARENA && cmd->type != CMD_ALLOC_ARENA_FILE &&
+        cmd->type != CMD_END &&
+        cmd->type != CMD_DEALLOC_ARENA && cmd->type != CMD_INVALID && cmd->type != CMD_SELECT_ARENA &&
+        cmd->type != CMD_CREATE_ARENA && cmd->type != CMD_LIST_ARENAS && cmd->type != CMD_DESTROY_ARENA)
+    {
+        strbuf_printf(out, "No arena is allocated.\n");
+        free(cmd->data);
+        cmd->data = NULL;
+        return 1;
+    }
+
+    switch (cmd->type)
+    {
+    case CMD_ALLOC_ARENA:
+        *arena = vma_alloc_arena(cmd->size);
+        if (*arena == NULL)
+            strbuf_printf(out, "The arena could not be allocated.\n");
+        break;
+    case CMD_ALLOC_ARENA_FILE:
+        *arena = vma_alloc_arena_file(cmd->size, cmd->path);
+        if (*arena == NULL)
+            strbuf_printf(out, "The arena could not be allocated.\n");
+        break;
+    case CMD_ALLOC_BLOCK:
+        text_alloc_block(*arena, cmd, out);
+        break;
+    case CMD_FREE_BLOCK:
+        text_free_block(*arena, cmd, out);
+        break;
+    case CMD_WRITE:
+        text_write(*arena, cmd, out);
+        break;
+    case CMD_READ:
+        text_read(*arena, cmd, out);
+        break;
+    case CMD_PMAP:
+        text_pmap(*arena, out);
+        if (vma_diff_tracking(*arena))
+            vma_diff_reset(*arena); // The next PMAP_DIFF starts from this map
+        break;
+    case CMD_PMAP_DIFF:
+        text_pmap_diff(*arena, out);
+        break;
+    case CMD_STATS:
+        text_stats(*arena, out);
+        break;
+    case CMD_HEAT_SAMPLE:
+        if (cmd->size > UINT32_MAX || vma_heat_config(*arena, cmd->size, cmd->address) != VMA_OK)
+            strbuf_printf(out, "Invalid sampling parameters.\n");
+        break;
+    case CMD_PAGED:
+        if (vma_paging_config(*arena, cmd->size) != VMA_OK)
+            strbuf_printf(out, "Paged storage could not be set up.\n");
+        break;
+    case CMD_MALLOC:
+        text_malloc(*arena, cmd, out);
+        break;
+    case CMD_MFREE:
+        text_mfree(*arena, cmd, out);
+        break;
+    case CMD_SWAP:
+        if (vma_swap_config(*arena, cmd->size) != VMA_OK)
+            strbuf_printf(out, "Swapping could not be set up.\n");
+        break;
+    case CMD_DEDUP:
+        text_dedup(*arena, out);
+        break;
+    case CMD_HEATMAP:
+        text_heatmap(*arena, cmd->size, out);
+        break;
+    case CMD_FLUSH:
+        if (vma_flush(*arena) != VMA_OK)
+            strbuf_printf(out, "The arena could not be flushed.\n");
+        break;
+    case CMD_MPROTECT:
+        if (cached_object(*arena, cmd->address) || vma_mprotect(*arena, cmd->address, cmd->perm) != VMA_OK)
+            strbuf_printf(out, "Invalid address for mprotect.\n");
+        break;
+    case CMD_SELECT_ARENA:
+    case CMD_CREATE_ARENA:
+    case CMD_LIST_ARENAS:
+    case CMD_DESTROY_ARENA:
+    case CMD_INVALID:
+        strbuf_printf(out, "Invalid command. Please try again.\n");
+        break;
+    case CMD_END:
+    case CMD_DEALLOC_ARENA:
+        if (*arena != NULL)
+            vma_dealloc_arena(*arena);
+        *arena = NULL;
+        free(cmd->data);
+        return 0;
+    }
+
+    free(cmd->data); // The WRITE payload is no longer needed
+    cmd->data = NULL;
+    return 1;
+}
+
+// Function to print the arenas listed by LIST_ARENAS, marking the selected one
+void text_list_arenas(vma_named_arena_t **entries, size_t count, const vma_named_arena_t *selected,
+                      strbuf_t *out)
+{
+    strbuf_printf(out, "Arenas: %zu\n", count);
+    for (size_t i = 0; i < count; i++)
+        strbuf_printf(out, "%c %s: %" PRIu64 " bytes\n", entries[i] == selected ? '*' : ' ',
+                      entries[i]->name, vma_arena_size(entries[i]->arena));
+}
+
+// Function to set up the arenas of a command stream, returns 0 if the host is out of memory
+int init_arena_set(arena_set_t *set)
+{
+    set->registry = vma_registry_create();
+    set->selected = NULL;
+    return set->registry != NULL;
+}
+
+// Function to get the arena the commands of a stream go to, NULL if there is none
+arena_t *selected_arena(const arena_set_t *set)
+{
+    return set->selected != NULL ? set->selected->arena : NULL;
+}
+
+// Function to add the arena of CREATE_ARENA, or the default one the first command allocates
+// and selects right away
+static void text_create_arena(arena_set_t *set, const command_t *cmd, const char *name,
+                              const int select, strbuf_t *out)
+{
+    arena_t *arena = NULL;
+    vma_named_arena_t *entry = NULL;
+
+    if (vma_registry_find(set->registry, name) != NULL)
+    {
+        strbuf_printf(out, "Arena %s already exists.\n", name);
+        return;
+    }
+
+    arena = cmd->type == CMD_ALLOC_ARENA_FILE ? vma_alloc_arena_file(cmd->size, cmd->path)
+                                              : vma_alloc_arena(cmd->size);
+    if (arena == NULL || vma_registry_add(set->registry, name, arena, &entry) != VMA_OK)
+    {
+        if (arena != NULL)
+            vma_dealloc_arena(arena);
+        strbuf_printf(out, "The arena could not be allocated.\n");
+        return;
+    }
+    if (select)
+        set->selected = entry;
+}
+
+// Function to remove an arena from the stream, freeing everything it holds at once
+static void text_destroy_arena(arena_set_t *set, const char *name, strbuf_t *out)
+{
+    vma_named_arena_t *entry = vma_registry_remove(set->registry, name);
+
+    if (entry == NULL)
+    {
+        strbuf_printf(out, "Arena %s does not exist.\n", name);
+        return;
+    }
+    if (set->selected == entry)
+        set->selected = NULL;
+    vma_registry_release(entry);
+}
+
+// Function to run one command of a stream, handling the commands that manage named arenas
+// and passing the others to the selected arena. Returns 0 once no more commands should run.
+int run_command(arena_set_t *set, command_t *cmd, strbuf_t *out)
+{
+    vma_named_arena_t **entries = NULL;
+    vma_named_arena_t *entry = NULL;
+    arena_t *arena = NULL;
+
+    switch (cmd->type)
+    {
+    case CMD_ALLOC_ARENA:
+    case CMD_ALLOC_ARENA_FILE:
+        text_create_arena(set, cmd, "default", 1, out);
+        return 1;
+    case CMD_CREATE_ARENA:
+        text_create_arena(set, cmd, cmd->name, 0, out);
+        return 1;
+    case CMD_SELECT_ARENA:
+        // The entry is the handle later commands use, the name is not looked up again
+        entry = vma_registry_find(set->registry, cmd->name);
+        if (entry == NULL)
+            strbuf_printf(out, "Arena %s does not exist.\n", cmd->name);
+        else
+            set->selected = entry;
+        return 1;
+    case CMD_LIST_ARENAS:
+        entries = vma_registry_sorted(set->registry);
+        if (entries != NULL)
+            text_list_arenas(entries, set->registry->size, set->selected, out);
+        free(entries);
+        return 1;
+    case CMD_DESTROY_ARENA:
+        text_destroy_arena(set, cmd->name, out);
+        return 1;
+    case CMD_END:
+    case CMD_DEALLOC_ARENA:
+        // The end of the stream takes every arena with it
+        execute_command(&arena, cmd, out);
+        vma_registry_destroy(set->registry);
+        set->registry = NULL;
+        set->selected = NULL;
+        return 0;
+    default:
+        if (set->selected == NULL)
+            return execute_command(&arena, cmd, out);
+        return execute_command(&set->selected->arena, cmd, out);
+    }
+}
+
+// Function to parse and run the commands of a stream one after another on this thread
+int run_sequential(FILE *stream)
+{
+    cmd_input_t *in = create_cmd_input(stream);
+    strbuf_t *out = create_strbuf(1 << 16);
+    arena_set_t arenas;
+    command_t cmd;
+    int running = in != NULL && out != NULL && init_arena_set(&arenas);
+
+    if (!running)
+    {
+        fprintf(stderr, "%s.\n", vma_strerror(VMA_ERR_NO_MEMORY));
+        delete_strbuf(out);
+        if (in != NULL)
+            delete_cmd_input(in);
+        return 1;
+    }
+
+    while (running)
+    {
+        next_command(in, &cmd);
+        running = run_command(&arenas, &cmd, out);
+        fwrite(out->data, 1, out->len, stdout);
+        out->len = 0;
+    }
+
+    delete_strbuf(out);
+    delete_cmd_input(in);
+    return 0;
+}
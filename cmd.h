@@ -0,0 +1,91 @@
+#pragma once
+#include "registry.h"
+#include "strbuf.h"
+#include "threadcache.h"
+#include "vma.h"
+
+// Types of commands understood by the simulator
+typedef enum
+{
+	CMD_END, // No more input, behaves like DEALLOC_ARENA
+	CMD_ALLOC_ARENA,
+	CMD_ALLOC_ARENA_FILE, // Arena backed by a sparse file
+	CMD_DEALLOC_ARENA,
+	CMD_ALLOC_BLOCK,
+	CMD_FREE_BLOCK,
+	CMD_READ,
+	CMD_WRITE,
+	CMD_PMAP,
+	CMD_PMAP_DIFF,
+	CMD_MPROTECT,
+	CMD_SELECT_ARENA,
+	CMD_CREATE_ARENA,
+	CMD_LIST_ARENAS,
+	CMD_DESTROY_ARENA,
+	CMD_STATS,
+	CMD_FLUSH,
+	CMD_HEAT_SAMPLE,
+	CMD_HEATMAP,
+	CMD_PAGED,
+	CMD_DEDUP,
+	CMD_SWAP,
+	CMD_MALLOC,
+	CMD_MFREE,
+	CMD_INVALID
+} command_type_t;
+
+// Definition of a parsed command
+typedef struct
+{
+	command_type_t type;
+	uint64_t address; // Also the bucket count of HEAT_SAMPLE
+	uint64_t size; // Also the sampling rate of HEAT_SAMPLE, the range count of HEATMAP and the hot bytes of PAGED
+	int8_t *data; // WRITE payload, freed once the command has run
+	uint64_t length; // Bytes of the payload in data; the input ended there, the rest are zeroes
+	uint8_t perm; // MPROTECT permissions
+	char name[VMA_NAME_SIZE]; // Arena name for the commands that manage named arenas
+	char path[256]; // Backing file of ALLOC_ARENA_FILE
+} command_t;
+
+// Results of parsing a command out of a buffer
+#define PARSE_DONE 1
+#define PARSE_NEED_MORE 0
+
+// Flags that change how a command is parsed
+#define PARSE_FIRST 1  // First command of the input, always allocates the arena
+#define PARSE_ARENAS 2 // Recognize ALLOC_ARENA(_FILE) by name, for the arena selected
+
+// Definition of a buffered command reader over a stream
+typedef struct
+{
+	FILE *stream;
+	char *buf;
+	size_t len, pos, cap;
+	int eof;
+	int first; // The first command of the input always allocates the arena
+} cmd_input_t;
+
+// Function prototypes for parsing commands
+int parse_command(const char *buf, size_t len, int eof, int flags,
+				  command_t *cmd, size_t *used);
+cmd_input_t *create_cmd_input(FILE *stream);
+int next_command(cmd_input_t *in, command_t *cmd);
+void delete_cmd_input(cmd_input_t *in);
+
+// Definition of the arenas of a command stream. The first command creates the one called
+// default, CREATE_ARENA adds more and SELECT_ARENA picks the one the other commands go to.
+typedef struct
+{
+	vma_registry_t *registry;
+	vma_named_arena_t *selected; // NULL once the selected arena has been destroyed
+} arena_set_t;
+
+// Function prototypes for the text front-end
+uint8_t mprotect_aux(char *string);
+int execute_command(arena_t **arena, command_t *cmd, strbuf_t *out);
+void text_list_arenas(vma_named_arena_t **entries, size_t count, const vma_named_arena_t *selected,
+					  strbuf_t *out);
+int init_arena_set(arena_set_t *set);
+arena_t *selected_arena(const arena_set_t *set);
+int run_command(arena_set_t *set, command_t *cmd, strbuf_t *out);
+int run_sequential(FILE *stream);
@@ -1,74 +1,36 @@
-#include "vma.h" // Include the header file for the virtual memory allocator
+#include "pipeline.h" // Include the header file for the command drivers
+#include "replay.h"
+#include "server.h"
+#include "trace.h"
 
-int main(void)
+int main(int argc, char *argv[])
 {
-	uint64_t arena_size = 0;
-	arena_t *arena = NULL; // Declare a pointer to an arena structure
-	char input[255];
-	char input_buffer;
-	uint64_t block_size = 0;
-	uint64_t address = 0;
-	uint64_t data_size = 0;
-	int8_t *data = NULL;
+	// Serve named arenas on a Unix domain socket: --server <path> [threads]
+	if (argc > 2 && strcmp(argv[1], "--server") == 0)
+		return run_server(argv[2], argc > 3 ? atoi(argv[3]) : 0);
 
-	// Read arena size and allocate memory for the arena
-	scanf("%s%ld%c", input, &arena_size, &input_buffer);
-	arena = alloc_arena(arena_size);
-
-	// Loop to process commands until DEALLOC_ARENA is encountered
-	while (strcmp(input, "DEALLOC_ARENA") != 0)
+	// Print the commands of a binary allocation trace: --decode <trace>
+	if (argc > 2 && strcmp(argv[1], "--decode") == 0)
 	{
-		scanf("%s", input); // Read the command
+		FILE *trace = fopen(argv[2], "rb");
+		int result = trace != NULL ? decode_trace(trace, stdout) : 1;
 
-		if (strcmp(input, "ALLOC_BLOCK") == 0)
-		{
-			// Read address and block size, then allocate a block
-			scanf("%ld%c%ld%c", &address, &input_buffer, &block_size, &input_buffer);
-			alloc_block(arena, address, block_size);
-		}
-		else if (strcmp(input, "FREE_BLOCK") == 0)
-		{
-			// Read address and free a block
-			scanf("%ld%c", &address, &input_buffer);
-			free_block(arena, address);
-		}
-		else if (strcmp(input, "WRITE") == 0)
-		{
-			// Read address, data size, and data, then perform a write operation
-			scanf("%ld%c%ld%c", &address, &input_buffer, &data_size, &input_buffer);
-			data = malloc(data_size);
-			fread(data, 1, data_size, stdin);
-			write(arena, address, data_size, data);
-		}
-		else if (strcmp(input, "READ") == 0)
-		{
-			// Read address and data size, then perform a read operation
-			scanf("%ld%c%ld%c", &address, &input_buffer, &data_size, &input_buffer);
-			read(arena, address, data_size);
-		}
-		else if (strcmp(input, "PMAP") == 0)
-		{
-			// Perform a pmap operation
-			pmap(arena);
-		}
-		else if (strncmp(input, "MPROTECT", 8) == 0 && strlen(input) == 8)
-		{
-			// Read address and permission string, then perform a memory protection operation
-			uint64_t address;
-			scanf("%ld", &address);
-			char string[100], c;
-			scanf("%c", &c);
-			fgets(string, 100, stdin);
-			int8_t data = mprotect_aux(string);
-			mprotect(arena, address, &data);
-		}
-		else if (strcmp(input, "DEALLOC_ARENA") != 0)
-		{
-			// Invalid command
-			printf("Invalid command. Please try again.\n");
-		}
+		if (trace != NULL)
+			fclose(trace);
+		if (result == 2)
+			fprintf(stderr, "Out of memory while decoding %s.\n", argv[2]);
+		else if (result != 0)
+			fprintf(stderr, "%s is not a binary trace.\n", argv[2]);
+		return result;
 	}
 
-	dealloc_arena(arena); // Deallocate the arena
-	return 0;
+	// Replay a trace with READ and WRITE on disjoint bytes in parallel: --parallel [threads]
+	if (argc > 1 && strcmp(argv[1], "--parallel") == 0)
+		return run_parallel(stdin, argc > 2 ? atoi(argv[2]) : 0);
+
+	// Parsing, execution and output run on their own threads, unless asked otherwise
+	if (argc > 1 && strcmp(argv[1], "--sequential") == 0)
+		return run_sequential(stdin);
+
+	return run_pipeline(stdin);
 }
@@ -0,0 +1,787 @@
+#define _GNU_SOURCE // For pread and pwrite
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pagestore.h" // Include the header file for the paged storage of miniblock data
+
+// Longest literal and repeat runs of the run-length codec
+#define RLE_MAX_LITERAL 128
+#define RLE_MIN_REPEAT 3
+#define RLE_MAX_REPEAT (RLE_MIN_REPEAT + 127)
+
+// Worst case size of an encoded page, every byte a literal
+#define RLE_BOUND (VMA_PAGE_SIZE + VMA_PAGE_SIZE / RLE_MAX_LITERAL + 1)
+
+// Function to encode bytes as runs: a control byte below 128 is followed by that many
+// plus one literal bytes, one from 128 up repeats the next byte (control - 125) times
+static uint32_t rle_encode(const uint8_t *src, const uint32_t size, uint8_t *dst)
+{
+    uint32_t in = 0;
+    uint32_t out = 0;
+    uint32_t run = 0;
+    uint32_t literal = 0;
+
+    while (in < size)
+    {
+        // Measure the run starting here
+        run = 1;
+        while (in + run < size && run < RLE_MAX_REPEAT && src[in + run] == src[in])
+            run++;
+
+        if (run >= RLE_MIN_REPEAT)
+        {
+            dst[out++] = (uint8_t)(run - RLE_MIN_REPEAT + 128);
+            dst[out++] = src[in];
+            in += run;
+            continue;
+        }
+
+        // Gather literals up to the next run worth encoding
+        literal = 0;
+        while (in + literal < size && literal < RLE_MAX_LITERAL)
+        {
+            if (in + literal + 2 < size && src[in + literal] == src[in + literal + 1] &&
+                src[in + literal] == src[in + literal + 2])
+                break;
+            literal++;
+        }
+        dst[out++] = (uint8_t)(literal - 1);
+        memcpy(dst + out, src + in, literal);
+        out += literal;
+        in += literal;
+    }
+    return out;
+}
+
+// Function to decode runs written by rle_encode into size bytes
+static void rle_decode(const uint8_t *src, const uint32_t length, uint8_t *dst, const uint32_t size)
+{
+    uint32_t in = 0;
+    uint32_t out = 0;
+    uint32_t run = 0;
+
+    while (in < length && out < size)
+    {
+        if (src[in] < 128)
+        {
+            run = src[in++] + 1;
+            memcpy(dst + out, src + in, run);
+            in += run;
+        }
+        else
+        {
+            run = src[in++] - 128 + RLE_MIN_REPEAT;
+            memset(dst + out, src[in++], run);
+        }
+        out += run;
+    }
+}
+
+// Function to get the number of bytes of a page, the last one of a table may be partial
+static uint32_t page_length(const vma_page_table_t *table, const size_t index)
+{
+    uint64_t left = table->size - (uint64_t)index * VMA_PAGE_SIZE;
+    return left < VMA_PAGE_SIZE ? left : VMA_PAGE_SIZE;
+}
+
+// Function to move a page from one state to another, keeping the counters right
+static void set_state(vma_page_store_t *store, vma_page_t *page, const uint8_t state)
+{
+    uint64_t *counts[] = {&store->stats.zero_pages, &store->stats.fill_pages,
+                          &store->stats.raw_pages, &store->stats.packed_pages,
+                          &store->stats.shared_pages, &store->stats.swapped_pages};
+
+    (*counts[page->state])--;
+    (*counts[state])++;
+    page->state = state;
+}
+
+// Function to add a page that now holds data to the resident ring; a page left out
+// because the ring could not grow is simply never swapped out
+static void resident_add(vma_page_store_t *store, vma_page_t *page)
+{
+    vma_page_t **resident = NULL;
+    size_t capacity = 0;
+
+    if (store->resident_count == store->resident_capacity)
+    {
+        capacity = store->resident_capacity > 0 ? store->resident_capacity * 2 : 64;
+        resident = realloc(store->resident, capacity * sizeof(vma_page_t *));
+        if (resident == NULL)
+            return;
+        store->resident = resident;
+        store->resident_capacity = capacity;
+    }
+    page->resident_slot = store->resident_count;
+    page->recent = 1;
+    store->resident[store->resident_count++] = page;
+}
+
+// Function to take a page out of the resident ring, moving the last page into its slot
+static void resident_remove(vma_page_store_t *store, vma_page_t *page)
+{
+    vma_page_t *last = NULL;
+
+    if (page->resident_slot == VMA_NO_SLOT)
+        return;
+    last = store->resident[--store->resident_count];
+    store->resident[page->resident_slot] = last;
+    last->resident_slot = page->resident_slot;
+    page->resident_slot = VMA_NO_SLOT;
+}
+
+// Function to replace the data of a page, keeping the stored byte count right. Pages are
+// in the resident ring exactly while they hold data of their own.
+static void set_data(vma_page_store_t *store, vma_page_t *page, uint8_t *data, const uint32_t length)
+{
+    if (page->data == NULL && data != NULL)
+        resident_add(store, page);
+    else if (page->data != NULL && data == NULL)
+        resident_remove(store, page);
+    free(page->data);
+    store->stats.stored_bytes -= page->length;
+    store->stats.stored_bytes += length;
+    page->data = data;
+    page->length = length;
+}
+
+// Function to add a raw page to the hot ring
+static int ring_add(vma_page_store_t *store, vma_page_t *page)
+{
+    vma_page_t **ring = NULL;
+    size_t capacity = 0;
+
+    if (store->ring_count == store->ring_capacity)
+    {
+        capacity = store->ring_capacity > 0 ? store->ring_capacity * 2 : 64;
+        ring = realloc(store->ring, capacity * sizeof(vma_page_t *));
+        if (ring == NULL)
+            return 0;
+        store->ring = ring;
+        store->ring_capacity = capacity;
+    }
+    page->slot = store->ring_count;
+    store->ring[store->ring_count++] = page;
+    store->ring_bytes += page->length;
+    return 1;
+}
+
+// Function to take a page out of the hot ring, moving the last page into its slot
+static void ring_remove(vma_page_store_t *store, vma_page_t *page)
+{
+    vma_page_t *last = store->ring[--store->ring_count];
+
+    store->ring[page->slot] = last;
+    last->slot = page->slot;
+    page->slot = VMA_NO_SLOT;
+    store->ring_bytes -= page->length;
+}
+
+// Function to get the number of bytes that runs written by rle_encode decode into
+static uint32_t rle_length(const uint8_t *src, const uint32_t length)
+{
+    uint32_t in = 0;
+    uint32_t out = 0;
+
+    while (in < length)
+    {
+        if (src[in] < 128)
+        {
+            out += src[in] + 1;
+            in += src[in] + 2;
+        }
+        else
+        {
+            out += src[in] - 128 + RLE_MIN_REPEAT;
+            in += 2;
+        }
+    }
+    return out;
+}
+
+// Function to hash the content of a raw or packed page (FNV-1a), the same for either form
+static uint64_t hash_page(const uint8_t state, const uint8_t *data, const uint32_t length)
+{
+    uint64_t hash = 14695981039346656037ull;
+    uint32_t in = 0;
+    uint32_t run = 0;
+    int literal = 1;
+
+    while (in < length)
+    {
+        // Runs give their byte once per repeat, raw data is a single literal run
+        if (state == VMA_PAGE_RAW)
+        {
+            run = length;
+        }
+        else
+        {
+            literal = data[in] < 128;
+            run = literal ? data[in] + 1u : data[in] - 128u + RLE_MIN_REPEAT;
+            in++;
+        }
+        for (; run > 0; run--)
+        {
+            hash ^= data[in];
+            hash *= 1099511628211ull;
+            in += literal;
+        }
+        in += !literal;
+    }
+    return hash;
+}
+
+// Function to check whether two raw or packed pages hold the same content. Encoding is
+// deterministic, so pages in the same form match byte for byte; otherwise the packed one is
+// decoded into the scratch buffer and compared with the raw one.
+static int same_content(vma_page_store_t *store, uint8_t state, const uint8_t *data,
+                        uint32_t length, uint8_t other_state, const uint8_t *other_data,
+                        uint32_t other_length)
+{
+    const uint8_t *swap_data = NULL;
+    uint32_t swap_length = 0;
+
+    if (state == other_state)
+        return length == other_length && memcmp(data, other_data, length) == 0;
+    if (state == VMA_PAGE_RAW)
+    {
+        swap_data = data;
+        swap_length = length;
+        data = other_data;
+        length = other_length;
+        other_data = swap_data;
+        other_length = swap_length;
+    }
+    if (rle_length(data, length) != other_length)
+        return 0;
+    rle_decode(data, length, store->scratch, other_length);
+    return memcmp(store->scratch, other_data, other_length) == 0;
+}
+
+// Function to find the slot of the shared page holding the given content (*slot is NULL if none)
+static vma_shared_page_t **find_shared(vma_page_store_t *store, const uint64_t hash,
+                                       const vma_page_t *page)
+{
+    vma_shared_page_t **slot = &store->buckets[hash & (store->bucket_count - 1)];
+
+    while (*slot != NULL && ((*slot)->hash != hash ||
+                             !same_content(store, (*slot)->state, (*slot)->data, (*slot)->length,
+                                           page->state, page->data, page->length)))
+        slot = &(*slot)->next;
+    return slot;
+}
+
+// Function to double the number of buckets of the shared pages
+static void grow_shared(vma_page_store_t *store)
+{
+    vma_shared_page_t **old = store->buckets;
+    size_t old_count = store->bucket_count;
+    vma_shared_page_t *shared = NULL;
+    vma_shared_page_t **slot = NULL;
+    size_t i;
+
+    store->buckets = calloc(old_count * 2, sizeof(vma_shared_page_t *));
+    if (store->buckets == NULL)
+    {
+        store->buckets = old; // Longer chains, but still correct
+        return;
+    }
+    store->bucket_count = old_count * 2;
+    for (i = 0; i < old_count; i++)
+    {
+        while (old[i] != NULL)
+        {
+            shared = old[i];
+            old[i] = shared->next;
+            slot = &store->buckets[shared->hash & (store->bucket_count - 1)];
+            shared->next = *slot;
+            *slot = shared;
+        }
+    }
+    free(old);
+}
+
+// Function to make a page point at shared content, dropping its own copy
+static void share_page(vma_page_store_t *store, vma_page_t *page, vma_shared_page_t *shared)
+{
+    if (page->slot != VMA_NO_SLOT)
+        ring_remove(store, page);
+    set_data(store, page, NULL, 0);
+    set_state(store, page, VMA_PAGE_SHARED);
+    page->shared = shared;
+    if (shared->refs++ > 0)
+        store->stats.saved_bytes += shared->length;
+}
+
+// Function to drop a page's reference to its shared content, freeing it with the last one
+static void unshare_page(vma_page_store_t *store, vma_page_t *page)
+{
+    vma_shared_page_t *shared = page->shared;
+    vma_shared_page_t **slot = NULL;
+
+    page->shared = NULL;
+    if (shared->refs > 1)
+        store->stats.saved_bytes -= shared->length;
+    if (--shared->refs > 0)
+        return;
+
+    slot = &store->buckets[shared->hash & (store->bucket_count - 1)];
+    while (*slot != shared)
+        slot = &(*slot)->next;
+    *slot = shared->next;
+    store->shared_count--;
+    store->stats.stored_bytes -= shared->length;
+    free(shared->data);
+    free(shared);
+}
+
+// Function to give a page of the swap file back; one that cannot be remembered is lost
+static void swap_release(vma_page_store_t *store, const uint32_t slot)
+{
+    uint32_t *free_slots = NULL;
+    size_t capacity = 0;
+
+    if (store->swap_free_count == store->swap_free_capacity)
+    {
+        capacity = store->swap_free_capacity > 0 ? store->swap_free_capacity * 2 : 64;
+        free_slots = realloc(store->swap_free, capacity * sizeof(uint32_t));
+        if (free_slots == NULL)
+            return;
+        store->swap_free = free_slots;
+        store->swap_free_capacity = capacity;
+    }
+    store->swap_free[store->swap_free_count++] = slot;
+}
+
+// Function to write the data of a page out to the swap file, in the form it had in memory
+static int page_swap_out(vma_page_store_t *store, vma_page_t *page)
+{
+    uint32_t slot = store->swap_free_count > 0 ? store->swap_free[store->swap_free_count - 1]
+                                               : store->swap_next;
+    ssize_t written = pwrite(fileno(store->swap_file), page->data, page->length,
+                             (off_t)slot * VMA_PAGE_SIZE);
+
+    if (written < 0 || (uint32_t)written != page->length)
+        return 0;
+    if (store->swap_free_count > 0)
+        store->swap_free_count--;
+    else
+        store->swap_next++;
+
+    if (page->slot != VMA_NO_SLOT)
+        ring_remove(store, page);
+    page->swap_slot = slot;
+    page->swap_length = page->length;
+    page->swap_state = page->state;
+    store->stats.evictions++;
+    store->stats.swap_out_bytes += page->length;
+    set_data(store, page, NULL, 0);
+    set_state(store, page, VMA_PAGE_SWAPPED);
+    return 1;
+}
+
+// Function to read a swapped page back into memory, as it was before it was swapped out
+static int page_swap_in(vma_page_store_t *store, vma_page_t *page)
+{
+    uint8_t *data = malloc(page->swap_length);
+    ssize_t got = 0;
+
+    if (data == NULL)
+        return 0;
+    got = pread(fileno(store->swap_file), data, page->swap_length,
+                (off_t)page->swap_slot * VMA_PAGE_SIZE);
+    if (got < 0 || (uint32_t)got != page->swap_length)
+    {
+        free(data);
+        return 0;
+    }
+
+    swap_release(store, page->swap_slot);
+    store->stats.faults++;
+    store->stats.swap_in_bytes += page->swap_length;
+    set_data(store, page, data, page->swap_length);
+    set_state(store, page, page->swap_state);
+    return 1;
+}
+
+// Function to create the paged storage of an arena
+vma_page_store_t *create_page_store(const uint64_t hot_limit)
+{
+    vma_page_store_t *store = calloc(1, sizeof(vma_page_store_t));
+    if (store == NULL)
+        return NULL;
+    store->hot_limit = hot_limit;
+    store->resident_limit = UINT64_MAX;
+    store->scratch = malloc(RLE_BOUND);
+    store->bucket_count = 64;
+    store->buckets = calloc(store->bucket_count, sizeof(vma_shared_page_t *));
+    if (store->scratch == NULL || store->buckets == NULL)
+    {
+        free(store->scratch);
+        free(store->buckets);
+        free(store);
+        return NULL;
+    }
+    return store;
+}
+
+// Function to delete the paged storage, once every page table in it has been deleted
+void delete_page_store(vma_page_store_t *store)
+{
+    if (store->swap_file != NULL)
+        fclose(store->swap_file);
+    free(store->ring);
+    free(store->resident);
+    free(store->swap_free);
+    free(store->scratch);
+    free(store->buckets);
+    free(store);
+}
+
+// Function to create the pages of a miniblock of the given size, all of them zero
+vma_page_table_t *create_page_table(vma_page_store_t *store, const uint64_t size)
+{
+    size_t count = (size + VMA_PAGE_SIZE - 1) / VMA_PAGE_SIZE;
+    vma_page_table_t *table = calloc(1, sizeof(vma_page_table_t) + count * sizeof(vma_page_t));
+    size_t i;
+
+    if (table == NULL)
+        return NULL;
+    table->size = size;
+    table->page_count = count;
+    for (i = 0; i < count; i++)
+    {
+        table->pages[i].slot = VMA_NO_SLOT;
+        table->pages[i].resident_slot = VMA_NO_SLOT;
+    }
+    store->stats.zero_pages += count;
+    return table;
+}
+
+// Function to delete the pages of a miniblock
+void delete_page_table(vma_page_store_t *store, vma_page_table_t *table)
+{
+    vma_page_t *page = NULL;
+    size_t i;
+
+    for (i = 0; i < table->page_count; i++)
+    {
+        page = &table->pages[i];
+        if (page->slot != VMA_NO_SLOT)
+            ring_remove(store, page);
+        if (page->state == VMA_PAGE_SHARED)
+            unshare_page(store, page);
+        if (page->state == VMA_PAGE_SWAPPED)
+            swap_release(store, page->swap_slot);
+        set_data(store, page, NULL, 0);
+        set_state(store, page, VMA_PAGE_ZERO);
+    }
+    store->stats.zero_pages -= table->page_count;
+    free(table);
+}
+
+// Function to turn a page back into raw bytes and put it in the hot ring
+static int page_unpack(vma_page_store_t *store, vma_page_table_t *table, vma_page_t *page)
+{
+    uint32_t length = page_length(table, page - table->pages);
+    uint8_t *data = NULL;
+
+    if (page->state == VMA_PAGE_SWAPPED && !page_swap_in(store, page))
+        return 0;
+    page->referenced = 1;
+    page->recent = 1;
+    if (page->state == VMA_PAGE_RAW)
+        return page->slot != VMA_NO_SLOT || ring_add(store, page);
+
+    data = malloc(length);
+    if (data == NULL)
+        return 0;
+    if (page->state == VMA_PAGE_PACKED)
+    {
+        rle_decode(page->data, page->length, data, length);
+        store->stats.decompressions++;
+    }
+    else if (page->state == VMA_PAGE_SHARED)
+    {
+        // Copy on write: the page gets its own content back
+        if (page->shared->state == VMA_PAGE_PACKED)
+        {
+            rle_decode(page->shared->data, page->shared->length, data, length);
+            store->stats.decompressions++;
+        }
+        else
+        {
+            memcpy(data, page->shared->data, length);
+        }
+        unshare_page(store, page);
+    }
+    else
+    {
+        memset(data, page->state == VMA_PAGE_FILL ? page->fill : 0, length);
+    }
+
+    set_data(store, page, data, length);
+    set_state(store, page, VMA_PAGE_RAW);
+    return ring_add(store, page);
+}
+
+// Function to shrink a cold raw page: a marker if it is one byte repeated, its runs if
+// that is smaller, otherwise it stays raw but leaves the ring until it is written again
+static void page_pack(vma_page_store_t *store, vma_page_t *page)
+{
+    uint32_t length = 0;
+    uint32_t i = 1;
+    uint8_t *data = NULL;
+
+    while (i < page->length && page->data[i] == page->data[0])
+        i++;
+    if (i == page->length)
+    {
+        page->fill = page->data[0];
+        set_data(store, page, NULL, 0);
+        set_state(store, page, page->fill == 0 ? VMA_PAGE_ZERO : VMA_PAGE_FILL);
+        return;
+    }
+
+    length = rle_encode(page->data, page->length, store->scratch);
+    if (length >= page->length)
+        return; // Incompressible
+    data = malloc(length);
+    if (data == NULL)
+        return;
+    memcpy(data, store->scratch, length);
+    set_data(store, page, data, length);
+    set_state(store, page, VMA_PAGE_PACKED);
+    store->stats.compressions++;
+}
+
+// Function to read size bytes from offset of a miniblock's pages
+int page_table_read(vma_page_store_t *store, vma_page_table_t *table, uint64_t offset,
+                    void *buffer, uint64_t size)
+{
+    vma_page_t *page = NULL;
+    uint64_t in_page = 0;
+    uint64_t chunk = 0;
+    uint8_t *out = buffer;
+
+    while (size > 0)
+    {
+        page = &table->pages[offset / VMA_PAGE_SIZE];
+        in_page = offset % VMA_PAGE_SIZE;
+        chunk = VMA_PAGE_SIZE - in_page < size ? VMA_PAGE_SIZE - in_page : size;
+        if (page->state == VMA_PAGE_SWAPPED && !page_swap_in(store, page))
+            return 0;
+
+        // Marker pages are read without being expanded
+        if (page->state == VMA_PAGE_ZERO || page->state == VMA_PAGE_FILL)
+        {
+            memset(out, page->state == VMA_PAGE_FILL ? page->fill : 0, chunk);
+        }
+        else if (page->state == VMA_PAGE_SHARED && page->shared->state == VMA_PAGE_RAW)
+        {
+            memcpy(out, page->shared->data + in_page, chunk);
+        }
+        else if (page->state == VMA_PAGE_SHARED)
+        {
+            // Shared pages are only copied once written, so decode into the scratch buffer
+            rle_decode(page->shared->data, page->shared->length, store->scratch,
+                       page_length(table, page - table->pages));
+            store->stats.decompressions++;
+            memcpy(out, store->scratch + in_page, chunk);
+        }
+        else
+        {
+            // Raw pages that did not compress stay out of the ring until they are written
+            if (page->state == VMA_PAGE_PACKED && !page_unpack(store, table, page))
+                return 0;
+            page->referenced = 1;
+            page->recent = 1;
+            memcpy(out, page->data + in_page, chunk);
+        }
+        out += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+    return 1;
+}
+
+// Function to write size bytes at offset of a miniblock's pages
+int page_table_write(vma_page_store_t *store, vma_page_table_t *table, uint64_t offset,
+                     const void *data, uint64_t size)
+{
+    vma_page_t *page = NULL;
+    uint64_t in_page = 0;
+    uint64_t chunk = 0;
+    const uint8_t *in = data;
+
+    while (size > 0)
+    {
+        page = &table->pages[offset / VMA_PAGE_SIZE];
+        in_page = offset % VMA_PAGE_SIZE;
+        chunk = VMA_PAGE_SIZE - in_page < size ? VMA_PAGE_SIZE - in_page : size;
+        if (!page_unpack(store, table, page))
+            return 0;
+        memcpy(page->data + in_page, in, chunk);
+        in += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+    return 1;
+}
+
+// Function to pack the coldest raw pages until the ring fits in the hot limit, then swap
+// out the coldest pages until the stored bytes fit in the resident limit. Pages accessed
+// since a hand last passed get a second chance, so hits only set a bit.
+void page_store_trim(vma_page_store_t *store)
+{
+    vma_page_t *page = NULL;
+
+    while (store->ring_bytes > store->hot_limit && store->ring_count > 0)
+    {
+        if (store->hand >= store->ring_count)
+            store->hand = 0;
+        page = store->ring[store->hand];
+        if (page->referenced)
+        {
+            page->referenced = 0;
+            store->hand++;
+            continue;
+        }
+
+        // The last page moves into this slot, so the hand stays put
+        ring_remove(store, page);
+        page_pack(store, page);
+    }
+
+    // Shared content stays in memory, so the resident ring may run out first
+    while (store->stats.stored_bytes > store->resident_limit && store->resident_count > 0)
+    {
+        if (store->resident_hand >= store->resident_count)
+            store->resident_hand = 0;
+        page = store->resident[store->resident_hand];
+        if (page->recent)
+        {
+            page->recent = 0;
+            store->resident_hand++;
+            continue;
+        }
+        if (!page_swap_out(store, page))
+            break; // The swap file is full or failing, stay over the limit
+    }
+}
+
+// Function to cap the bytes of page data held in memory, opening the swap file on first use
+int page_store_swap_config(vma_page_store_t *store, const uint64_t resident_limit)
+{
+    if (store->swap_file == NULL)
+    {
+        store->swap_file = tmpfile(); // Deleted once closed
+        if (store->swap_file == NULL)
+            return 0;
+    }
+    store->resident_limit = resident_limit;
+    page_store_trim(store);
+    return 1;
+}
+
+// Function to get the bytes of memory holding the data of a miniblock
+uint64_t page_table_stored(const vma_page_table_t *table)
+{
+    uint64_t stored = 0;
+    size_t i;
+
+    // Shared content is split between the pages holding it
+    for (i = 0; i < table->page_count; i++)
+        stored += table->pages[i].state == VMA_PAGE_SHARED
+                      ? table->pages[i].shared->length / table->pages[i].shared->refs
+                      : table->pages[i].length;
+    return stored;
+}
+
+// Function to get ready to deduplicate, with room for every page that holds data
+int page_store_dedup_begin(vma_page_store_t *store)
+{
+    size_t capacity = 64;
+
+    while (capacity < 2 * (store->stats.raw_pages + store->stats.packed_pages))
+        capacity *= 2;
+    store->candidates = calloc(capacity, sizeof(vma_page_t *));
+    if (store->candidates == NULL)
+        return 0;
+    store->candidate_capacity = capacity;
+    return 1;
+}
+
+// Function to share the pages of a miniblock with identical ones. A page matching shared
+// content joins it; one matching a page seen earlier in this run turns the two into shared
+// content; any other page is remembered in case an identical one shows up later.
+void page_table_dedup(vma_page_store_t *store, vma_page_table_t *table)
+{
+    vma_shared_page_t **slot = NULL;
+    vma_shared_page_t *shared = NULL;
+    vma_page_t *page = NULL;
+    vma_page_t *candidate = NULL;
+    uint64_t hash = 0;
+    size_t probe = 0;
+    size_t i;
+
+    for (i = 0; i < table->page_count; i++)
+    {
+        page = &table->pages[i];
+        if (page->state != VMA_PAGE_RAW && page->state != VMA_PAGE_PACKED)
+            continue; // Markers store nothing, shared pages are already shared
+        store->stats.scanned_pages++;
+
+        hash = hash_page(page->state, page->data, page->length);
+        slot = find_shared(store, hash, page);
+        if (*slot != NULL)
+        {
+            share_page(store, page, *slot);
+            continue;
+        }
+
+        // Look for a page with the same content among the ones seen once, by linear probing;
+        // the content counts, not whether it happens to be packed
+        probe = hash & (store->candidate_capacity - 1);
+        while ((candidate = store->candidates[probe]) != NULL &&
+               !same_content(store, candidate->state, candidate->data, candidate->length,
+                             page->state, page->data, page->length))
+            probe = (probe + 1) & (store->candidate_capacity - 1);
+        if (candidate == NULL)
+        {
+            store->candidates[probe] = page;
+            continue;
+        }
+
+        // The earlier page hands its content over to the new shared page
+        shared = malloc(sizeof(vma_shared_page_t));
+        if (shared == NULL)
+            continue;
+        if (candidate->slot != VMA_NO_SLOT)
+            ring_remove(store, candidate);
+        resident_remove(store, candidate);
+        shared->hash = hash;
+        shared->refs = 1;
+        shared->length = candidate->length;
+        shared->state = candidate->state;
+        shared->data = candidate->data;
+        shared->next = *slot;
+        *slot = shared;
+        candidate->data = NULL;
+        candidate->length = 0;
+        candidate->shared = shared;
+        set_state(store, candidate, VMA_PAGE_SHARED);
+        share_page(store, page, shared);
+        if (++store->shared_count > store->bucket_count)
+            grow_shared(store);
+    }
+}
+
+// Function to forget the pages seen once by the deduplication that just ran
+void page_store_dedup_end(vma_page_store_t *store)
+{
+    free(store->candidates);
+    store->candidates = NULL;
+    store->candidate_capacity = 0;
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "vma.h"
+
+// Size of a page of miniblock data; pages are counted from the start of their miniblock
+#define VMA_PAGE_SIZE 4096
+
+// Keeps a function of the library out of the symbols libvma.so exports
+#define VMA_HIDDEN __attribute__((visibility("hidden")))
+
+// Slot of a page that is not in the hot ring
+#define VMA_NO_SLOT UINT32_MAX
+
+// States of a page of miniblock data
+typedef enum
+{
+	VMA_PAGE_ZERO,	 // All zeroes, nothing is stored
+	VMA_PAGE_FILL,	 // Every byte equals fill, nothing is stored
+	VMA_PAGE_RAW,	 // Uncompressed in data
+	VMA_PAGE_PACKED, // Run-length encoded in data
+	VMA_PAGE_SHARED, // Held by a shared page along with identical ones, copied on write
+	VMA_PAGE_SWAPPED // Written out to the swap file, read back on access
+} vma_page_state_t;
+
+// Definition of the content of identical pages merged by deduplication
+typedef struct vma_shared_page_t
+{
+	uint64_t hash;
+	uint32_t refs;
+	uint32_t length;
+	uint8_t state; // VMA_PAGE_RAW or VMA_PAGE_PACKED, like the pages it came from
+	uint8_t *data;
+	struct vma_shared_page_t *next; // Next in the same bucket
+} vma_shared_page_t;
+
+// Definition of a page of miniblock data
+typedef struct
+{
+	uint8_t *data;
+	vma_shared_page_t *shared; // Content of a shared page
+	uint32_t length;		   // Bytes held in data
+	uint32_t slot;			   // Position in the hot ring, VMA_NO_SLOT when it is not there
+	uint32_t resident_slot;	   // Position in the resident ring, likewise
+	uint32_t swap_slot;		   // Page of the swap file holding a swapped page
+	uint16_t swap_length;	   // Bytes of it in use
+	uint8_t swap_state;		   // VMA_PAGE_RAW or VMA_PAGE_PACKED, as it was swapped out
+	uint8_t state;
+	uint8_t fill;
+	uint8_t referenced;		   // Second-chance bit, set by every access
+	uint8_t recent;			   // Same for the resident ring, which has a hand of its own
+} vma_page_t;
+
+// Definition of the pages of one miniblock, the last one may be partial
+typedef struct
+{
+	uint64_t size;
+	size_t page_count;
+	vma_page_t pages[];
+} vma_page_table_t;
+
+// Definition of the paged storage of an arena. Raw pages sit in a ring swept by a clock
+// hand; once they take more than hot_limit bytes, those not accessed since the hand last
+// passed are compressed. Every page holding data of its own also sits in a second ring;
+// once the stored bytes go over resident_limit, a second hand swaps its cold pages out.
+typedef struct
+{
+	vma_page_t **ring;
+	size_t ring_count;
+	size_t ring_capacity;
+	size_t hand;
+	uint64_t ring_bytes;
+	uint64_t hot_limit;
+	uint8_t *scratch; // Encoding buffer of one page
+	vma_page_counters_t stats;
+
+	// Shared pages by hash, and the pages seen once by the deduplication being run
+	vma_shared_page_t **buckets;
+	size_t bucket_count;
+	size_t shared_count;
+	vma_page_t **candidates;
+	size_t candidate_capacity;
+
+	// Pages that may be swapped out, and the swap file with its free pages
+	vma_page_t **resident;
+	size_t resident_count;
+	size_t resident_capacity;
+	size_t resident_hand;
+	uint64_t resident_limit; // UINT64_MAX until swapping is turned on
+	FILE *swap_file;
+	uint32_t swap_next;		 // First page of the swap file never used
+	uint32_t *swap_free;
+	size_t swap_free_count;
+	size_t swap_free_capacity;
+} vma_page_store_t;
+
+// Function prototypes for the paged storage, which only the library itself calls
+VMA_HIDDEN vma_page_store_t *create_page_store(const uint64_t hot_limit);
+VMA_HIDDEN void delete_page_store(vma_page_store_t *store);
+VMA_HIDDEN vma_page_table_t *create_page_table(vma_page_store_t *store, const uint64_t size);
+VMA_HIDDEN void delete_page_table(vma_page_store_t *store, vma_page_table_t *table);
+VMA_HIDDEN int page_table_read(vma_page_store_t *store, vma_page_table_t *table, uint64_t offset,
+							   void *buffer, uint64_t size);
+VMA_HIDDEN int page_table_write(vma_page_store_t *store, vma_page_table_t *table, uint64_t offset,
+								const void *data, uint64_t size);
+VMA_HIDDEN void page_store_trim(vma_page_store_t *store);
+VMA_HIDDEN int page_store_swap_config(vma_page_store_t *store, const uint64_t resident_limit);
+VMA_HIDDEN uint64_t page_table_stored(const vma_page_table_t *table);
+VMA_HIDDEN int page_store_dedup_begin(vma_page_store_t *store);
+VMA_HIDDEN void page_table_dedup(vma_page_store_t *store, vma_page_table_t *table);
+VMA_HIDDEN void page_store_dedup_end(vma_page_store_t *store);
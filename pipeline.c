@@ -0,0 +1,285 @@
+#include "pipeline.h" // Include the header file for the pipelined driver
+
+// Output is handed to the output thread in chunks of about this many bytes
+#define OUTPUT_CHUNK (1 << 16)
+// Number of failed attempts before a side stops spinning and sleeps
+#define RING_SPIN 128
+
+// Definition of the state shared by the three stages
+typedef struct
+{
+    cmd_input_t *in;
+    spsc_ring_t *commands; // Parser -> executor, holds command_t
+    spsc_ring_t *outputs;  // Executor -> output, holds strbuf_t *, NULL ends the stream
+    arena_set_t arenas;    // Used by the executor only
+    strbuf_t *out;         // Output chunk the executor is filling
+} pipeline_t;
+
+// Function to create a ring with room for capacity elements (rounded up to a power of two),
+// returns NULL if the host is out of memory
+spsc_ring_t *create_ring(size_t capacity, size_t elem_size)
+{
+    spsc_ring_t *ring = malloc(sizeof(spsc_ring_t));
+
+    if (ring == NULL)
+        return NULL;
+    ring->capacity = 1;
+    while (ring->capacity < capacity)
+        ring->capacity <<= 1;
+    ring->elem_size = elem_size;
+    ring->slots = malloc(ring->capacity * elem_size);
+    if (ring->slots == NULL)
+    {
+        free(ring);
+        return NULL;
+    }
+    ring->head = ring->tail = 0;
+    ring->push_waiting = ring->pop_waiting = 0;
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->cond, NULL);
+    return ring;
+}
+
+// Function to wake the other side if it went to sleep on the ring
+static void ring_wake(spsc_ring_t *ring, int *waiting)
+{
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_broadcast(&ring->cond);
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
+
+// Function to store an element if there is room, without waking anyone
+static int ring_put(spsc_ring_t *ring, void *elem)
+{
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (tail - head == ring->capacity)
+        return 0;
+
+    memcpy(ring->slots + (tail & (ring->capacity - 1)) * ring->elem_size, elem, ring->elem_size);
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+    return 1;
+}
+
+// Function to take an element if there is one, without waking anyone
+static int ring_take(spsc_ring_t *ring, void *elem)
+{
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (head == tail)
+        return 0;
+
+    memcpy(elem, ring->slots + (head & (ring->capacity - 1)) * ring->elem_size, ring->elem_size);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+    return 1;
+}
+
+// Function to push an element without blocking, returns 0 if the ring is full
+int ring_try_push(spsc_ring_t *ring, const void *elem)
+{
+    if (!ring_put(ring, (void *)elem))
+        return 0;
+    ring_wake(ring, &ring->pop_waiting);
+    return 1;
+}
+
+// Function to pop an element without blocking, returns 0 if the ring is empty
+int ring_try_pop(spsc_ring_t *ring, void *elem)
+{
+    if (!ring_take(ring, elem))
+        return 0;
+    ring_wake(ring, &ring->push_waiting);
+    return 1;
+}
+
+// Function to retry an operation, spinning briefly and then sleeping until the other side moves
+static void ring_wait(spsc_ring_t *ring, int (*op)(spsc_ring_t *, void *), void *elem,
+                      int *waiting, int *other_waiting)
+{
+    for (int i = 0; i < RING_SPIN; i++)
+    {
+        if (op(ring, elem))
+        {
+            ring_wake(ring, other_waiting);
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    for (;;)
+    {
+        // Announce the wait before checking again, so a concurrent push or pop sees it
+        __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+        if (op(ring, elem))
+            break;
+        pthread_cond_wait(&ring->cond, &ring->lock);
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ring->lock);
+    ring_wake(ring, other_waiting);
+}
+
+// Function to push an element, waiting while the ring is full
+void ring_push(spsc_ring_t *ring, const void *elem)
+{
+    ring_wait(ring, ring_put, (void *)elem, &ring->push_waiting, &ring->pop_waiting);
+}
+
+// Function to pop an element, waiting while the ring is empty
+void ring_pop(spsc_ring_t *ring, void *elem)
+{
+    ring_wait(ring, ring_take, elem, &ring->pop_waiting, &ring->push_waiting);
+}
+
+// Function to delete a ring (elements still inside are not freed)
+void delete_ring(spsc_ring_t *ring)
+{
+    if (ring == NULL)
+        return;
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->cond);
+    free(ring->slots);
+    free(ring);
+}
+
+// Parser stage: turn the input into commands, WRITE payloads travel by pointer
+static void *parser_stage(void *arg)
+{
+    pipeline_t *pipe = arg;
+    command_t cmd;
+
+    do
+    {
+        next_command(pipe->in, &cmd);
+        ring_push(pipe->commands, &cmd);
+    } while (cmd.type != CMD_END && cmd.type != CMD_DEALLOC_ARENA);
+
+    return NULL;
+}
+
+// Function to hand the output gathered so far to the output thread. That only happens once a
+// chunk to replace it is allocated; until then the executor keeps filling the one it has.
+static void hand_over(pipeline_t *pipe)
+{
+    strbuf_t *next = create_strbuf(OUTPUT_CHUNK);
+
+    if (next == NULL)
+        return;
+    ring_push(pipe->outputs, &pipe->out);
+    pipe->out = next;
+}
+
+// Executor stage: run the commands in order, collecting their output in chunks
+static void *executor_stage(void *arg)
+{
+    pipeline_t *pipe = arg;
+    strbuf_t *done = NULL;
+    command_t cmd;
+    int running = 1;
+
+    while (running)
+    {
+        // Hand over what we have before waiting, so interactive sessions still see replies
+        if (!ring_try_pop(pipe->commands, &cmd))
+        {
+            if (pipe->out->len > 0)
+                hand_over(pipe);
+            ring_pop(pipe->commands, &cmd);
+        }
+
+        running = run_command(&pipe->arenas, &cmd, pipe->out);
+        if (pipe->out->len >= OUTPUT_CHUNK && running)
+            hand_over(pipe);
+    }
+
+    // The last chunk goes over as it is, then NULL marks the end of the output
+    ring_push(pipe->outputs, &pipe->out);
+    pipe->out = NULL;
+    ring_push(pipe->outputs, &done);
+    return NULL;
+}
+
+// Output stage: write the chunks to stdout in the order they were produced
+static void *output_stage(void *arg)
+{
+    pipeline_t *pipe = arg;
+    strbuf_t *chunk = NULL;
+
+    for (;;)
+    {
+        if (!ring_try_pop(pipe->outputs, &chunk))
+        {
+            fflush(stdout); // Nothing else is ready, let the reader see what we have
+            ring_pop(pipe->outputs, &chunk);
+        }
+        if (chunk == NULL)
+            break;
+        fwrite(chunk->data, 1, chunk->len, stdout);
+        delete_strbuf(chunk);
+    }
+
+    fflush(stdout);
+    return NULL;
+}
+
+// Function to free what run_pipeline() built, which may be only part of it
+static void delete_pipeline(pipeline_t *pipe)
+{
+    delete_ring(pipe->commands);
+    delete_ring(pipe->outputs);
+    delete_strbuf(pipe->out);
+    if (pipe->in != NULL)
+        delete_cmd_input(pipe->in);
+}
+
+// Function to run the commands of a stream through the parser, executor and output threads.
+// Everything is built before the input is touched, so if anything fails the stream goes to
+// the sequential driver instead. The parser starts last, and runs on this thread if it must.
+int run_pipeline(FILE *stream)
+{
+    pipeline_t pipe;
+    pthread_t parser, executor, output;
+    strbuf_t *done = NULL;
+    int parsing = 0;
+
+    pipe.in = create_cmd_input(stream);
+    pipe.commands = create_ring(1024, sizeof(command_t));
+    pipe.outputs = create_ring(64, sizeof(strbuf_t *));
+    pipe.out = create_strbuf(OUTPUT_CHUNK);
+    if (pipe.in == NULL || pipe.commands == NULL || pipe.outputs == NULL || pipe.out == NULL ||
+        !init_arena_set(&pipe.arenas))
+    {
+        delete_pipeline(&pipe);
+        return run_sequential(stream);
+    }
+
+    if (pthread_create(&output, NULL, output_stage, &pipe) != 0)
+    {
+        vma_registry_destroy(pipe.arenas.registry);
+        delete_pipeline(&pipe);
+        return run_sequential(stream);
+    }
+    if (pthread_create(&executor, NULL, executor_stage, &pipe) != 0)
+    {
+        ring_push(pipe.outputs, &done);
+        pthread_join(output, NULL);
+        vma_registry_destroy(pipe.arenas.registry);
+        delete_pipeline(&pipe);
+        return run_sequential(stream);
+    }
+    parsing = pthread_create(&parser, NULL, parser_stage, &pipe) == 0;
+    if (!parsing)
+        parser_stage(&pipe);
+
+    if (parsing)
+        pthread_join(parser, NULL);
+    pthread_join(executor, NULL);
+    pthread_join(output, NULL);
+    delete_pipeline(&pipe);
+    return 0;
+}
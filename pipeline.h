@@ -0,0 +1,31 @@
+#pragma once
+#include <pthread.h>
+
+#include "cmd.h"
+
+// Definition of a bounded single-producer single-consumer ring of fixed-size elements.
+// The indices only ever grow; a slot is index & (capacity - 1).
+typedef struct
+{
+	char *slots;
+	size_t elem_size;
+	size_t capacity; // Power of two
+	size_t head;	 // Next slot to pop, written by the consumer only
+	char pad[64];	 // Keep head and tail on different cache lines
+	size_t tail;	 // Next slot to push, written by the producer only
+	int push_waiting; // The producer sleeps until there is room
+	int pop_waiting;  // The consumer sleeps until there is an element
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} spsc_ring_t;
+
+// Function prototypes for the ring buffers
+spsc_ring_t *create_ring(size_t capacity, size_t elem_size);
+int ring_try_push(spsc_ring_t *ring, const void *elem);
+int ring_try_pop(spsc_ring_t *ring, void *elem);
+void ring_push(spsc_ring_t *ring, const void *elem);
+void ring_pop(spsc_ring_t *ring, void *elem);
+void delete_ring(spsc_ring_t *ring);
+
+// Function prototype for the pipelined driver (parser, executor and output threads)
+int run_pipeline(FILE *stream);
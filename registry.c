@@ -0,0 +1,165 @@
+#include "registry.h" // Include the header file for the registry of named arenas
+
+// Function to hash an arena name (FNV-1a)
+static uint64_t hash_name(const char *name)
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    while (*name)
+    {
+        hash ^= (unsigned char)*name++;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Function to create an empty registry
+vma_registry_t *vma_registry_create(void)
+{
+    vma_registry_t *registry = malloc(sizeof(vma_registry_t));
+
+    if (registry == NULL)
+        return NULL;
+    registry->bucket_count = 64;
+    registry->buckets = calloc(registry->bucket_count, sizeof(vma_named_arena_t *));
+    registry->size = 0;
+    if (registry->buckets == NULL)
+    {
+        free(registry);
+        return NULL;
+    }
+    return registry;
+}
+
+// Function to free an entry along with its arena
+void vma_registry_release(vma_named_arena_t *entry)
+{
+    if (entry->arena != NULL)
+        vma_dealloc_arena(entry->arena);
+    free(entry);
+}
+
+// Function to delete the registry along with every arena still in it
+void vma_registry_destroy(vma_registry_t *registry)
+{
+    vma_named_arena_t *entry = NULL;
+    size_t i;
+
+    for (i = 0; i < registry->bucket_count; i++)
+    {
+        while (registry->buckets[i] != NULL)
+        {
+            entry = registry->buckets[i];
+            registry->buckets[i] = entry->next;
+            vma_registry_release(entry);
+        }
+    }
+    free(registry->buckets);
+    free(registry);
+}
+
+// Function to find the bucket slot pointing at the named entry (or at the NULL ending the chain)
+static vma_named_arena_t **find_slot(const vma_registry_t *registry, const char *name,
+                                     const uint64_t hash)
+{
+    vma_named_arena_t **slot = &registry->buckets[hash & (registry->bucket_count - 1)];
+
+    while (*slot != NULL && ((*slot)->hash != hash || strcmp((*slot)->name, name) != 0))
+        slot = &(*slot)->next;
+    return slot;
+}
+
+// Function to double the number of buckets once the registry gets as full as it is wide
+static void grow_registry(vma_registry_t *registry)
+{
+    vma_named_arena_t **buckets = calloc(2 * registry->bucket_count, sizeof(vma_named_arena_t *));
+    vma_named_arena_t *entry = NULL;
+    vma_named_arena_t **slot = NULL;
+    size_t i;
+
+    if (buckets == NULL)
+        return; // The chains just get longer
+
+    for (i = 0; i < registry->bucket_count; i++)
+    {
+        while (registry->buckets[i] != NULL)
+        {
+            entry = registry->buckets[i];
+            registry->buckets[i] = entry->next;
+            slot = &buckets[entry->hash & (2 * registry->bucket_count - 1)];
+            entry->next = *slot;
+            *slot = entry;
+        }
+    }
+    free(registry->buckets);
+    registry->buckets = buckets;
+    registry->bucket_count *= 2;
+}
+
+// Function to register an arena under a name, which must be free and fit in VMA_NAME_SIZE
+vma_status_t vma_registry_add(vma_registry_t *registry, const char *name, arena_t *arena,
+                              vma_named_arena_t **entry)
+{
+    uint64_t hash = hash_name(name);
+    vma_named_arena_t **slot = find_slot(registry, name, hash);
+
+    if (*slot != NULL || strlen(name) >= VMA_NAME_SIZE)
+        return VMA_ERR_NAME;
+
+    *entry = malloc(sizeof(vma_named_arena_t));
+    if (*entry == NULL)
+        return VMA_ERR_NO_MEMORY;
+    strcpy((*entry)->name, name);
+    (*entry)->hash = hash;
+    (*entry)->arena = arena;
+    (*entry)->owner = NULL;
+    (*entry)->next = NULL;
+    *slot = *entry;
+    if (++registry->size > registry->bucket_count)
+        grow_registry(registry);
+    return VMA_OK;
+}
+
+// Function to find the named entry, returns NULL if there is no such arena
+vma_named_arena_t *vma_registry_find(const vma_registry_t *registry, const char *name)
+{
+    return *find_slot(registry, name, hash_name(name));
+}
+
+// Function to unlink the named entry, returns NULL if there is no such arena
+vma_named_arena_t *vma_registry_remove(vma_registry_t *registry, const char *name)
+{
+    vma_named_arena_t **slot = find_slot(registry, name, hash_name(name));
+    vma_named_arena_t *entry = *slot;
+
+    if (entry != NULL)
+    {
+        *slot = entry->next;
+        entry->next = NULL;
+        registry->size--;
+    }
+    return entry;
+}
+
+// Function to compare two entries by name, for sorting
+static int compare_name(const void *a, const void *b)
+{
+    return strcmp((*(vma_named_arena_t *const *)a)->name, (*(vma_named_arena_t *const *)b)->name);
+}
+
+// Function to list the entries sorted by name, returns NULL if the host is out of memory
+vma_named_arena_t **vma_registry_sorted(const vma_registry_t *registry)
+{
+    vma_named_arena_t **entries = malloc((registry->size + 1) * sizeof(vma_named_arena_t *));
+    vma_named_arena_t *entry = NULL;
+    size_t count = 0;
+    size_t i;
+
+    if (entries == NULL)
+        return NULL;
+    for (i = 0; i < registry->bucket_count; i++)
+        for (entry = registry->buckets[i]; entry != NULL; entry = entry->next)
+            entries[count++] = entry;
+    qsort(entries, count, sizeof(vma_named_arena_t *), compare_name);
+    return entries;
+}
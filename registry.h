@@ -0,0 +1,36 @@
+#pragma once
+#include "vma.h"
+
+// Longest name of an arena, terminator included
+#define VMA_NAME_SIZE 64
+
+// Definition of an arena registered under a name. Entries do not move, so a pointer to one
+// is a handle that saves looking the name up again.
+typedef struct vma_named_arena_t
+{
+	char name[VMA_NAME_SIZE];
+	uint64_t hash; // Of the name, compared before the name itself
+	arena_t *arena;
+	void *owner; // Left to the caller, e.g. for the lock a server serializes the arena with
+	struct vma_named_arena_t *next; // Next in the same bucket
+} vma_named_arena_t;
+
+// Definition of a hash table of named arenas, each with its own pools and storage
+typedef struct
+{
+	vma_named_arena_t **buckets;
+	size_t bucket_count; // Power of two
+	size_t size;
+} vma_registry_t;
+
+// Function prototypes for the registry of named arenas. Adding hands the arena over to the
+// registry; removing hands it back, along with its entry, until vma_registry_release().
+// vma_registry_sorted() returns the entries by name, in an array the caller frees.
+vma_registry_t *vma_registry_create(void);
+void vma_registry_destroy(vma_registry_t *registry);
+vma_status_t vma_registry_add(vma_registry_t *registry, const char *name, arena_t *arena,
+							  vma_named_arena_t **entry);
+vma_named_arena_t *vma_registry_find(const vma_registry_t *registry, const char *name);
+vma_named_arena_t *vma_registry_remove(vma_registry_t *registry, const char *name);
+void vma_registry_release(vma_named_arena_t *entry);
+vma_named_arena_t **vma_registry_sorted(const vma_registry_t *registry);
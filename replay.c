@@ -0,0 +1,387 @@
+#define _GNU_SOURCE // For sysconf
+#include "replay.h" // Include the header file for the parallel replay driver
+
+#include <pthread.h>
+#include <unistd.h>
+
+// Number of READ and WRITE commands gathered before they are scheduled (power of two)
+#define REPLAY_WINDOW 256
+
+// Definition of a command of the window, along with the later ones waiting for it
+typedef struct
+{
+    command_t cmd;
+    uint64_t start; // Bytes the command may touch, start to end
+    uint64_t end;
+    strbuf_t *out;
+    int deps;            // Earlier commands it still waits for, changed atomically
+    uint32_t first_edge; // Its first edge plus one, 0 if nothing waits for it
+} replay_task_t;
+
+// Definition of an edge of the conflict graph, linking the tasks waiting for the same one
+typedef struct
+{
+    uint32_t task;
+    uint32_t next; // Next edge plus one
+} replay_edge_t;
+
+// Definition of the tasks ready to run on one worker: the worker takes the newest from the
+// bottom, idle workers steal the oldest from the top. The indices only ever grow; a task is
+// queued once per window, so a slot is index & (REPLAY_WINDOW - 1).
+typedef struct
+{
+    uint32_t tasks[REPLAY_WINDOW];
+    size_t top;
+    size_t bottom;
+    pthread_mutex_t lock;
+} replay_deque_t;
+
+// Definition of the argument of a worker thread
+typedef struct
+{
+    struct replay_t *replay;
+    int id;
+} replay_worker_t;
+
+// Definition of the replay engine, shared by the reader and the workers
+typedef struct replay_t
+{
+    arena_set_t arenas; // Only changed between windows, by barrier commands
+    replay_task_t tasks[REPLAY_WINDOW];
+    replay_edge_t *edges; // Room for an edge between every two tasks of a window
+    size_t edge_count;
+    replay_deque_t *deques;
+    replay_worker_t *workers;
+    pthread_t *pool;
+    int thread_count;
+    int started; // Workers running, this thread (worker 0) included
+    int queued;    // Tasks sitting in a deque, changed atomically
+    int remaining; // Tasks of the window not finished yet, changed atomically
+    int sleepers;  // Workers waiting for work, changed atomically
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t work; // Signalled when tasks are queued, the window ends or the pool stops
+} replay_t;
+
+// Function to check whether READ and WRITE can share an arena between threads. They only
+// read the block list and treaps, unless paged storage, heat sampling or read-ahead on a
+// file keeps state that every access updates.
+static int arena_parallel(const arena_t *arena)
+{
+    vma_page_stats_t pages;
+    vma_heat_info_t heat;
+
+    return arena != NULL && vma_page_stats(arena, &pages) == VMA_ERR_UNSUPPORTED &&
+           vma_heat_get(arena, &heat) == VMA_ERR_UNSUPPORTED && !vma_file_backed(arena);
+}
+
+// Function to check whether two commands of a window must keep their order
+static int tasks_conflict(const replay_task_t *a, const replay_task_t *b)
+{
+    if (a->start >= a->end || b->start >= b->end)
+        return 0; // Touches nothing
+    if (a->start >= b->end || b->start >= a->end)
+        return 0; // Disjoint
+    return a->cmd.type == CMD_WRITE || b->cmd.type == CMD_WRITE;
+}
+
+// Function to add a command to the window, linking it after the earlier ones it conflicts with
+static void add_task(replay_t *replay, const size_t index, const command_t *cmd)
+{
+    replay_task_t *task = &replay->tasks[index];
+    replay_task_t *other = NULL;
+    size_t i;
+
+    task->cmd = *cmd;
+    task->start = cmd->address;
+    task->end = cmd->address + cmd->size < cmd->address ? UINT64_MAX : cmd->address + cmd->size;
+    task->deps = 0;
+    task->first_edge = 0;
+    task->out->len = 0;
+
+    for (i = index; i-- > 0;)
+    {
+        other = &replay->tasks[i];
+        if (!tasks_conflict(task, other))
+            continue;
+        replay->edges[replay->edge_count].task = index;
+        replay->edges[replay->edge_count].next = other->first_edge;
+        other->first_edge = ++replay->edge_count;
+        task->deps++;
+
+        // Whatever conflicts with us further back also conflicts with a write covering us,
+        // which already waits for it
+        if (other->cmd.type == CMD_WRITE && other->start <= task->start && other->end >= task->end)
+            break;
+    }
+}
+
+// Function to queue a task on a worker's deque, waking a worker if any is asleep
+static void queue_task(replay_t *replay, const int id, const uint32_t task)
+{
+    replay_deque_t *deque = &replay->deques[id];
+
+    pthread_mutex_lock(&deque->lock);
+    deque->tasks[deque->bottom++ & (REPLAY_WINDOW - 1)] = task;
+    pthread_mutex_unlock(&deque->lock);
+
+    // Announce the task before looking for sleepers; a worker announces itself before looking
+    // for tasks, so one of the two always sees the other
+    __atomic_add_fetch(&replay->queued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&replay->sleepers, __ATOMIC_SEQ_CST) > 0)
+    {
+        pthread_mutex_lock(&replay->lock);
+        pthread_cond_signal(&replay->work);
+        pthread_mutex_unlock(&replay->lock);
+    }
+}
+
+// Function to take a task from a deque, the newest for its owner and the oldest for a thief.
+// Returns -1 if it is empty.
+static int64_t take_task(replay_t *replay, const int id, const int steal)
+{
+    replay_deque_t *deque = &replay->deques[id];
+    int64_t task = -1;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top)
+        task = deque->tasks[(steal ? deque->top++ : --deque->bottom) & (REPLAY_WINDOW - 1)];
+    pthread_mutex_unlock(&deque->lock);
+    if (task >= 0)
+        __atomic_sub_fetch(&replay->queued, 1, __ATOMIC_SEQ_CST);
+    return task;
+}
+
+// Function to run a task, then queue the ones that were only waiting for it
+static void run_task(replay_t *replay, const int id, const uint32_t index)
+{
+    replay_task_t *task = &replay->tasks[index];
+    arena_t *arena = selected_arena(&replay->arenas);
+    replay_edge_t *edge = NULL;
+    uint32_t next = 0;
+
+    execute_command(&arena, &task->cmd, task->out);
+    for (next = task->first_edge; next != 0; next = edge->next)
+    {
+        edge = &replay->edges[next - 1];
+        if (__atomic_sub_fetch(&replay->tasks[edge->task].deps, 1, __ATOMIC_ACQ_REL) == 0)
+            queue_task(replay, id, edge->task);
+    }
+
+    // The reader sleeps along with the workers, so wake them all to let it see the end
+    if (__atomic_sub_fetch(&replay->remaining, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        pthread_mutex_lock(&replay->lock);
+        pthread_cond_broadcast(&replay->work);
+        pthread_mutex_unlock(&replay->lock);
+    }
+}
+
+// Function to run a task from a worker's own deque, or one stolen from another, returns 0
+// if none was queued anywhere
+static int run_next(replay_t *replay, const int id)
+{
+    int64_t task = take_task(replay, id, 0);
+    int i;
+
+    for (i = 1; task < 0 && i < replay->thread_count; i++)
+        task = take_task(replay, (id + i) % replay->thread_count, 1);
+    if (task < 0)
+        return 0;
+    run_task(replay, id, task);
+    return 1;
+}
+
+// Worker thread: run tasks until the pool stops, sleeping while there are none
+static void *replay_worker(void *arg)
+{
+    replay_worker_t *worker = arg;
+    replay_t *replay = worker->replay;
+    int stop = 0;
+
+    while (!stop)
+    {
+        if (run_next(replay, worker->id))
+            continue;
+
+        pthread_mutex_lock(&replay->lock);
+        __atomic_add_fetch(&replay->sleepers, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&replay->queued, __ATOMIC_SEQ_CST) == 0 && !replay->stop)
+            pthread_cond_wait(&replay->work, &replay->lock);
+        __atomic_sub_fetch(&replay->sleepers, 1, __ATOMIC_SEQ_CST);
+        stop = replay->stop;
+        pthread_mutex_unlock(&replay->lock);
+    }
+    return NULL;
+}
+
+// Function to run the commands of the window on the pool, which this thread joins as worker
+// 0, and print their output in order
+static void run_window(replay_t *replay, const size_t count)
+{
+    uint32_t roots[REPLAY_WINDOW];
+    size_t root_count = 0;
+    size_t i;
+
+    if (count == 0)
+        return;
+
+    // Find the commands that wait for nothing before any runs, since running them makes
+    // more ready, then hand them out to the workers in turn
+    for (i = 0; i < count; i++)
+        if (replay->tasks[i].deps == 0)
+            roots[root_count++] = i;
+    __atomic_store_n(&replay->remaining, (int)count, __ATOMIC_SEQ_CST);
+    for (i = 0; i < root_count; i++)
+        queue_task(replay, i % replay->thread_count, roots[i]);
+
+    while (__atomic_load_n(&replay->remaining, __ATOMIC_SEQ_CST) > 0)
+    {
+        if (run_next(replay, 0))
+            continue;
+
+        // Everything left is running elsewhere or waits for something that is
+        pthread_mutex_lock(&replay->lock);
+        __atomic_add_fetch(&replay->sleepers, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&replay->queued, __ATOMIC_SEQ_CST) == 0 &&
+               __atomic_load_n(&replay->remaining, __ATOMIC_SEQ_CST) > 0)
+            pthread_cond_wait(&replay->work, &replay->lock);
+        __atomic_sub_fetch(&replay->sleepers, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&replay->lock);
+    }
+
+    for (i = 0; i < count; i++)
+        fwrite(replay->tasks[i].out->data, 1, replay->tasks[i].out->len, stdout);
+    replay->edge_count = 0;
+}
+
+// Function to stop the workers and free the replay engine, which may be only partly built
+static void delete_replay(replay_t *replay)
+{
+    int i;
+
+    pthread_mutex_lock(&replay->lock);
+    replay->stop = 1;
+    pthread_cond_broadcast(&replay->work);
+    pthread_mutex_unlock(&replay->lock);
+    for (i = 1; i < replay->started; i++)
+        pthread_join(replay->pool[i], NULL);
+    for (i = 0; replay->deques != NULL && i < replay->thread_count; i++)
+        pthread_mutex_destroy(&replay->deques[i].lock);
+
+    for (i = 0; i < REPLAY_WINDOW; i++)
+        delete_strbuf(replay->tasks[i].out);
+    pthread_mutex_destroy(&replay->lock);
+    pthread_cond_destroy(&replay->work);
+    free(replay->edges);
+    free(replay->deques);
+    free(replay->workers);
+    free(replay->pool);
+    free(replay);
+}
+
+// Function to build the replay engine and start its workers, returns NULL if the host is
+// out of memory or cannot start the threads
+static replay_t *create_replay(const int threads)
+{
+    replay_t *replay = calloc(1, sizeof(replay_t));
+    int failed = 0;
+    int i;
+
+    if (replay == NULL)
+        return NULL;
+    pthread_mutex_init(&replay->lock, NULL);
+    pthread_cond_init(&replay->work, NULL);
+    replay->thread_count = threads;
+    replay->started = 1;
+    replay->edges = malloc(REPLAY_WINDOW * (REPLAY_WINDOW - 1) / 2 * sizeof(replay_edge_t));
+    replay->deques = calloc(threads, sizeof(replay_deque_t));
+    replay->workers = malloc(threads * sizeof(replay_worker_t));
+    replay->pool = malloc(threads * sizeof(pthread_t));
+    failed = replay->edges == NULL || replay->deques == NULL || replay->workers == NULL ||
+             replay->pool == NULL;
+    for (i = 0; replay->deques != NULL && i < threads; i++)
+        pthread_mutex_init(&replay->deques[i].lock, NULL);
+    for (i = 0; i < REPLAY_WINDOW; i++)
+    {
+        replay->tasks[i].out = create_strbuf(256);
+        failed = failed || replay->tasks[i].out == NULL;
+    }
+
+    // This thread is worker 0, the pool brings the others
+    for (i = 1; !failed && i < threads; i++)
+    {
+        replay->workers[i].replay = replay;
+        replay->workers[i].id = i;
+        failed = pthread_create(&replay->pool[i], NULL, replay_worker, &replay->workers[i]) != 0;
+        if (!failed)
+            replay->started++;
+    }
+    if (failed)
+    {
+        delete_replay(replay);
+        return NULL;
+    }
+    return replay;
+}
+
+// Function to replay the commands of a stream: runs of READ and WRITE go to the pool a window
+// at a time, every other command waits for them and runs alone on this thread. Without the
+// memory or the threads for the pool, the commands run one by one instead.
+int run_parallel(FILE *stream, int threads)
+{
+    cmd_input_t *in = NULL;
+    strbuf_t *out = NULL;
+    replay_t *replay = NULL;
+    command_t cmd;
+    size_t count = 0;
+    int running = 0;
+
+    if (threads < 1)
+        threads = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    in = create_cmd_input(stream);
+    out = create_strbuf(1 << 16);
+    replay = in != NULL && out != NULL ? create_replay(threads) : NULL;
+    if (replay == NULL)
+    {
+        delete_strbuf(out);
+        if (in != NULL)
+            delete_cmd_input(in);
+        return run_sequential(stream);
+    }
+    running = init_arena_set(&replay->arenas);
+
+    while (running)
+    {
+        // Run what we have before waiting for input, so interactive sessions still see replies
+        if (count > 0 && in->pos == in->len && !in->eof)
+        {
+            run_window(replay, count);
+            count = 0;
+        }
+
+        next_command(in, &cmd);
+        if ((cmd.type == CMD_READ || cmd.type == CMD_WRITE) && arena_parallel(selected_arena(&replay->arenas)))
+        {
+            add_task(replay, count++, &cmd);
+            if (count == REPLAY_WINDOW)
+            {
+                run_window(replay, count);
+                count = 0;
+            }
+            continue;
+        }
+
+        // Everything else may look at or change the whole arena, so it acts as a barrier
+        run_window(replay, count);
+        count = 0;
+        running = run_command(&replay->arenas, &cmd, out);
+        fwrite(out->data, 1, out->len, stdout);
+        out->len = 0;
+    }
+
+    delete_replay(replay);
+    delete_strbuf(out);
+    delete_cmd_input(in);
+    return 0;
+}
@@ -0,0 +1,6 @@
+#pragma once
+#include "cmd.h"
+
+// Function prototype for the parallel replay driver: READ and WRITE commands touching
+// disjoint bytes run side by side on a pool of threads, the output keeps the input order
+int run_parallel(FILE *stream, int threads);
@@ -0,0 +1,414 @@
+#define _GNU_SOURCE // For accept4 and the Linux event interfaces
+#include "server.h" // Include the header file for the socket server
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "session.h"
+
+// Bytes read from a connection in one go
+#define READ_CHUNK (1 << 16)
+// A connection whose unsent replies grow past this stops being read until they drain
+#define OUTPUT_HIGH_WATER (1 << 20)
+// Most bytes a connection may leave waiting for the rest of a command, e.g. a WRITE payload
+#define INPUT_LIMIT (64 << 20)
+// Events handled per epoll_wait call
+#define MAX_EVENTS 64
+
+// Definition of a client connection, only ever touched by the worker that owns it
+typedef struct connection_t
+{
+    int fd;
+    session_t *session;
+    strbuf_t *in;  // Bytes received that do not form a complete command yet
+    strbuf_t *out; // Replies not sent yet
+    int eof;       // The client closed its side
+    uint32_t events; // Events currently registered with epoll
+    struct connection_t *next, *prev;
+} connection_t;
+
+// Definition of an event loop thread
+typedef struct
+{
+    pthread_t thread;
+    int epoll_fd;
+    int wake_fd; // eventfd, signalled for new connections and for shutdown
+    arena_table_t *table;
+    pthread_mutex_t lock;
+    connection_t *pending; // Accepted connections waiting to be registered, under lock
+    int stopping;          // Under lock
+    connection_t *connections;
+} worker_t;
+
+static volatile sig_atomic_t server_stop = 0;
+
+// Function to ask the accept loop to stop
+static void handle_stop_signal(int sig)
+{
+    (void)sig;
+    server_stop = 1;
+}
+
+// Function to close a connection and forget it
+static void close_connection(worker_t *worker, connection_t *conn)
+{
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    if (conn->prev != NULL)
+        conn->prev->next = conn->next;
+    else
+        worker->connections = conn->next;
+    if (conn->next != NULL)
+        conn->next->prev = conn->prev;
+    delete_session(conn->session);
+    delete_strbuf(conn->in);
+    delete_strbuf(conn->out);
+    free(conn);
+}
+
+// Function to read what the client sent, returns 0 on a socket error
+static int read_connection(connection_t *conn)
+{
+    ssize_t got = 0;
+    int i;
+
+    // Read until the socket is drained, but give other clients a turn after a few chunks
+    for (i = 0; i < 16 && conn->in->len < INPUT_LIMIT; i++)
+    {
+        if (!strbuf_reserve(conn->in, READ_CHUNK))
+            return 0;
+        got = recv(conn->fd, conn->in->data + conn->in->len, READ_CHUNK, 0);
+        if (got > 0)
+        {
+            conn->in->len += got;
+            continue;
+        }
+        if (got == 0)
+            conn->eof = 1;
+        else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return 0;
+        break;
+    }
+    return 1;
+}
+
+// Function to run every complete command received, keeping the incomplete tail for later
+static void process_connection(connection_t *conn)
+{
+    size_t used = session_feed(conn->session, conn->in->data, conn->in->len, conn->eof,
+                               conn->out);
+
+    memmove(conn->in->data, conn->in->data + used, conn->in->len - used);
+    conn->in->len -= used;
+}
+
+// Function to send the batched replies, returns 0 on a socket error
+static int flush_connection(connection_t *conn)
+{
+    size_t sent = 0;
+    ssize_t done = 0;
+
+    while (sent < conn->out->len)
+    {
+        done = send(conn->fd, conn->out->data + sent, conn->out->len - sent, MSG_NOSIGNAL);
+        if (done < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        sent += done;
+    }
+
+    memmove(conn->out->data, conn->out->data + sent, conn->out->len - sent);
+    conn->out->len -= sent;
+    return 1;
+}
+
+// Function to register the events the connection needs next with epoll
+static void update_interest(worker_t *worker, connection_t *conn)
+{
+    struct epoll_event event;
+    uint32_t wanted = 0;
+
+    if (!conn->eof && conn->out->len < OUTPUT_HIGH_WATER)
+        wanted |= EPOLLIN;
+    if (conn->out->len > 0)
+        wanted |= EPOLLOUT;
+    if (wanted == conn->events)
+        return;
+
+    event.events = wanted;
+    event.data.ptr = conn;
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+    conn->events = wanted;
+}
+
+// Function to handle the events reported for a connection
+static void serve_connection(worker_t *worker, connection_t *conn, uint32_t events)
+{
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !conn->eof)
+    {
+        if (!read_connection(conn))
+        {
+            close_connection(worker, conn);
+            return;
+        }
+    }
+
+    // Run the batch only while the replies can still be taken, then answer it in one send
+    if (conn->out->len < OUTPUT_HIGH_WATER)
+        process_connection(conn);
+
+    // A command too large to wait for is refused, and the connection closes once that is sent
+    if (conn->in->len >= INPUT_LIMIT)
+    {
+        strbuf_printf(conn->out, "Command too large, closing the connection.\n");
+        conn->in->len = 0;
+        conn->eof = 1;
+    }
+    if (!flush_connection(conn) || (conn->eof && conn->out->len == 0))
+    {
+        close_connection(worker, conn);
+        return;
+    }
+    update_interest(worker, conn);
+}
+
+// Function to register the connections handed over by the accept loop
+static int adopt_pending(worker_t *worker)
+{
+    connection_t *conn = NULL;
+    struct epoll_event event;
+    int stopping = 0;
+    eventfd_t counter = 0;
+
+    eventfd_read(worker->wake_fd, &counter); // Reset the descriptor, the count itself is not needed
+
+    pthread_mutex_lock(&worker->lock);
+    conn = worker->pending;
+    worker->pending = NULL;
+    stopping = worker->stopping;
+    pthread_mutex_unlock(&worker->lock);
+
+    while (conn != NULL)
+    {
+        connection_t *next = conn->next;
+
+        conn->prev = NULL;
+        conn->next = worker->connections;
+        if (worker->connections != NULL)
+            worker->connections->prev = conn;
+        worker->connections = conn;
+
+        conn->events = EPOLLIN;
+        event.events = EPOLLIN;
+        event.data.ptr = conn;
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, conn->fd, &event);
+        conn = next;
+    }
+    return stopping;
+}
+
+// Event loop of a worker thread
+static void *worker_loop(void *arg)
+{
+    worker_t *worker = arg;
+    struct epoll_event events[MAX_EVENTS];
+    int ready = 0;
+    int stopping = 0;
+    int i;
+
+    while (!stopping)
+    {
+        ready = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, -1);
+        for (i = 0; i < ready; i++)
+        {
+            if (events[i].data.ptr == NULL)
+                stopping = adopt_pending(worker);
+            else
+                serve_connection(worker, events[i].data.ptr, events[i].events);
+        }
+    }
+
+    while (worker->connections != NULL)
+        close_connection(worker, worker->connections);
+    return NULL;
+}
+
+// Function to start a worker thread with its own epoll instance, returns 0 on failure
+static int start_worker(worker_t *worker, arena_table_t *table)
+{
+    struct epoll_event event;
+
+    worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    worker->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    worker->table = table;
+    worker->pending = NULL;
+    worker->stopping = 0;
+    worker->connections = NULL;
+    pthread_mutex_init(&worker->lock, NULL);
+
+    event.events = EPOLLIN;
+    event.data.ptr = NULL; // The wake descriptor is the only entry without a connection
+    if (worker->epoll_fd >= 0 && worker->wake_fd >= 0 &&
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wake_fd, &event) == 0 &&
+        pthread_create(&worker->thread, NULL, worker_loop, worker) == 0)
+        return 1;
+
+    if (worker->epoll_fd >= 0)
+        close(worker->epoll_fd);
+    if (worker->wake_fd >= 0)
+        close(worker->wake_fd);
+    pthread_mutex_destroy(&worker->lock);
+    return 0;
+}
+
+// Function to hand a connection (or, with NULL, the order to stop) to a worker
+static void notify_worker(worker_t *worker, connection_t *conn)
+{
+    pthread_mutex_lock(&worker->lock);
+    if (conn != NULL)
+    {
+        conn->next = worker->pending;
+        worker->pending = conn;
+    }
+    else
+    {
+        worker->stopping = 1;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    eventfd_write(worker->wake_fd, 1);
+}
+
+// Function to stop a worker thread and release its resources
+static void stop_worker(worker_t *worker)
+{
+    notify_worker(worker, NULL);
+    pthread_join(worker->thread, NULL);
+    close(worker->epoll_fd);
+    close(worker->wake_fd);
+    pthread_mutex_destroy(&worker->lock);
+}
+
+// Function to serve named arenas on a Unix domain socket until SIGINT or SIGTERM.
+// Connections are spread over the worker threads; commands on different arenas run in parallel.
+int run_server(const char *path, int threads)
+{
+    struct sockaddr_un addr;
+    struct sigaction action;
+    arena_table_t *table = NULL;
+    worker_t *workers = NULL;
+    connection_t *conn = NULL;
+    int listen_fd = -1;
+    int fd = -1;
+    size_t next = 0;
+    int i;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Socket path is too long.\n");
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, 128) < 0)
+    {
+        perror("server");
+        if (listen_fd >= 0)
+            close(listen_fd);
+        return 1;
+    }
+
+    // No SA_RESTART, so a signal interrupts accept and the loop can notice the stop
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_stop_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    if (threads < 1)
+        threads = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    table = create_arena_table();
+    workers = malloc(threads * sizeof(worker_t));
+    if (table == NULL || workers == NULL)
+    {
+        fprintf(stderr, "The server could not be started.\n");
+        if (table != NULL)
+            delete_arena_table(table);
+        free(workers);
+        close(listen_fd);
+        unlink(path);
+        return 1;
+    }
+    for (i = 0; i < threads; i++)
+        if (!start_worker(&workers[i], table))
+            break;
+    if (i < threads)
+    {
+        perror("server");
+        while (i-- > 0)
+            stop_worker(&workers[i]);
+        free(workers);
+        delete_arena_table(table);
+        close(listen_fd);
+        unlink(path);
+        return 1;
+    }
+
+    while (!server_stop)
+    {
+        fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno != EINTR && errno != ECONNABORTED)
+                perror("accept");
+            continue;
+        }
+
+        // A client the host has no memory for is turned away
+        conn = calloc(1, sizeof(connection_t));
+        if (conn != NULL)
+        {
+            conn->session = create_session(table);
+            conn->in = create_strbuf(READ_CHUNK);
+            conn->out = create_strbuf(READ_CHUNK);
+        }
+        if (conn == NULL || conn->session == NULL || conn->in == NULL || conn->out == NULL)
+        {
+            if (conn != NULL)
+            {
+                delete_session(conn->session);
+                delete_strbuf(conn->in);
+                delete_strbuf(conn->out);
+                free(conn);
+            }
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->eof = 0;
+        notify_worker(&workers[next++ % threads], conn);
+    }
+
+    for (i = 0; i < threads; i++)
+        stop_worker(&workers[i]);
+    free(workers);
+    delete_arena_table(table);
+    close(listen_fd);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+// Function prototype for the Unix domain socket server hosting named arenas
+int run_server(const char *path, int threads);
@@ -0,0 +1,291 @@
+#include "session.h" // Include the header file for client sessions
+
+#include <pthread.h>
+
+#include "cmd.h"
+
+// Definition of what the server keeps for a named arena, as the owner of its registry entry;
+// the lock serializes the commands run on it
+typedef struct
+{
+    pthread_mutex_t lock;
+    size_t refs; // Sessions currently using the entry, protected by the table lock
+    int removed; // Already unlinked, freed when the last reference goes away
+} arena_entry_t;
+
+// Definition of the table of named arenas
+struct arena_table_t
+{
+    vma_registry_t *registry;
+    pthread_mutex_t lock;
+};
+
+// Definition of a client session
+struct session_t
+{
+    arena_table_t *table;
+    char name[VMA_NAME_SIZE]; // Arena the commands go to
+    vma_named_arena_t *held;  // Entry locked by the batch being run, if any
+};
+
+// Function to get the server state of a registry entry
+static arena_entry_t *entry_state(const vma_named_arena_t *named)
+{
+    return named->owner;
+}
+
+// Function to create an empty table of named arenas, returns NULL if the host is out of memory
+arena_table_t *create_arena_table(void)
+{
+    arena_table_t *table = malloc(sizeof(arena_table_t));
+
+    if (table == NULL)
+        return NULL;
+    table->registry = vma_registry_create();
+    if (table->registry == NULL)
+    {
+        free(table);
+        return NULL;
+    }
+    pthread_mutex_init(&table->lock, NULL);
+    return table;
+}
+
+// Function to free the server state of an entry, then the entry and the arena inside it
+static void delete_entry(vma_named_arena_t *named)
+{
+    pthread_mutex_destroy(&entry_state(named)->lock);
+    free(named->owner);
+    vma_registry_release(named);
+}
+
+// Function to delete the table along with every arena still in it
+void delete_arena_table(arena_table_t *table)
+{
+    vma_named_arena_t **entries = vma_registry_sorted(table->registry);
+    size_t i;
+
+    for (i = 0; entries != NULL && i < table->registry->size; i++)
+    {
+        pthread_mutex_destroy(&entry_state(entries[i])->lock);
+        free(entries[i]->owner);
+    }
+    free(entries);
+    vma_registry_destroy(table->registry);
+    pthread_mutex_destroy(&table->lock);
+    free(table);
+}
+
+// Function to take a reference to the named entry, returns NULL if there is no such arena
+static vma_named_arena_t *acquire_entry(arena_table_t *table, const char *name)
+{
+    vma_named_arena_t *named = NULL;
+
+    pthread_mutex_lock(&table->lock);
+    named = vma_registry_find(table->registry, name);
+    if (named != NULL)
+        entry_state(named)->refs++;
+    pthread_mutex_unlock(&table->lock);
+    return named;
+}
+
+// Function to drop a reference, freeing the entry if it was the last one of a removed arena
+static void release_entry(arena_table_t *table, vma_named_arena_t *named)
+{
+    int last = 0;
+
+    pthread_mutex_lock(&table->lock);
+    last = --entry_state(named)->refs == 0 && entry_state(named)->removed;
+    pthread_mutex_unlock(&table->lock);
+    if (last)
+        delete_entry(named);
+}
+
+// Function to create a session, starting on the arena called "default";
+// returns NULL if the host is out of memory
+session_t *create_session(arena_table_t *table)
+{
+    session_t *session = malloc(sizeof(session_t));
+
+    if (session == NULL)
+        return NULL;
+    session->table = table;
+    strcpy(session->name, "default");
+    session->held = NULL;
+    return session;
+}
+
+// Function to unlock and release the arena held by the session
+static void drop_held(session_t *session)
+{
+    if (session->held == NULL)
+        return;
+    pthread_mutex_unlock(&entry_state(session->held)->lock);
+    release_entry(session->table, session->held);
+    session->held = NULL;
+}
+
+// Function to add an arena under the given name, backed by the file at path if it is not NULL.
+// The arena is allocated without the table lock, which is only held to look the name up and
+// to add the entry, so a large arena does not stall the sessions using other ones.
+static void session_alloc_arena(session_t *session, const char *name, uint64_t size,
+                                const char *path, strbuf_t *out)
+{
+    arena_table_t *table = session->table;
+    arena_entry_t *entry = NULL;
+    vma_named_arena_t *named = NULL;
+    arena_t *arena = NULL;
+    vma_status_t status = VMA_OK;
+
+    // Catch a taken name before paying for the arena
+    pthread_mutex_lock(&table->lock);
+    named = vma_registry_find(table->registry, name);
+    pthread_mutex_unlock(&table->lock);
+    if (named != NULL)
+    {
+        strbuf_printf(out, "Arena %s already exists.\n", name);
+        return;
+    }
+
+    entry = malloc(sizeof(arena_entry_t));
+    arena = path != NULL ? vma_alloc_arena_file(size, path) : vma_alloc_arena(size);
+    if (entry == NULL || arena == NULL)
+    {
+        free(entry);
+        if (arena != NULL)
+            vma_dealloc_arena(arena);
+        strbuf_printf(out, "The arena could not be allocated.\n");
+        return;
+    }
+    pthread_mutex_init(&entry->lock, NULL);
+    entry->refs = 0;
+    entry->removed = 0;
+
+    // Another session may have taken the name meanwhile, the registry catches that
+    pthread_mutex_lock(&table->lock);
+    status = vma_registry_add(table->registry, name, arena, &named);
+    if (status == VMA_OK)
+        named->owner = entry;
+    pthread_mutex_unlock(&table->lock);
+    if (status == VMA_OK)
+        return;
+
+    pthread_mutex_destroy(&entry->lock);
+    free(entry);
+    vma_dealloc_arena(arena);
+    if (status == VMA_ERR_NAME)
+        strbuf_printf(out, "Arena %s already exists.\n", name);
+    else
+        strbuf_printf(out, "The arena could not be allocated.\n");
+}
+
+// Function to remove the named arena from the table, freeing it once nobody uses it
+static void session_dealloc_arena(session_t *session, const char *name, strbuf_t *out)
+{
+    arena_table_t *table = session->table;
+    vma_named_arena_t *named = NULL;
+    int unused = 0;
+
+    pthread_mutex_lock(&table->lock);
+    named = vma_registry_remove(table->registry, name);
+    if (named != NULL)
+    {
+        entry_state(named)->removed = 1;
+        unused = entry_state(named)->refs == 0;
+    }
+    pthread_mutex_unlock(&table->lock);
+
+    if (named == NULL)
+        strbuf_printf(out, "Arena %s does not exist.\n", name);
+    else if (unused)
+        delete_entry(named);
+}
+
+// Function to list the arenas of the table, marking the one the session has selected
+static void session_list_arenas(session_t *session, strbuf_t *out)
+{
+    arena_table_t *table = session->table;
+    vma_named_arena_t **entries = NULL;
+
+    pthread_mutex_lock(&table->lock);
+    entries = vma_registry_sorted(table->registry);
+    if (entries != NULL)
+        text_list_arenas(entries, table->registry->size,
+                         vma_registry_find(table->registry, session->name), out);
+    pthread_mutex_unlock(&table->lock);
+    free(entries);
+}
+
+// Function to parse and run every complete command in buf, appending the replies to out.
+// The arena stays locked across the commands of one call, which is released before returning.
+// Returns the number of bytes consumed; the rest must be passed again with more data.
+size_t session_feed(session_t *session, const char *buf, size_t len, int eof,
+                    strbuf_t *out)
+{
+    size_t consumed = 0;
+    size_t used = 0;
+    command_t cmd;
+
+    while (parse_command(buf + consumed, len - consumed, eof, PARSE_ARENAS, &cmd,
+                         &used) == PARSE_DONE &&
+           cmd.type != CMD_END)
+    {
+        consumed += used;
+
+        // Commands that change which arena exists or is selected run without holding one
+        if (cmd.type == CMD_SELECT_ARENA || cmd.type == CMD_ALLOC_ARENA ||
+            cmd.type == CMD_ALLOC_ARENA_FILE || cmd.type == CMD_DEALLOC_ARENA ||
+            cmd.type == CMD_CREATE_ARENA || cmd.type == CMD_DESTROY_ARENA ||
+            cmd.type == CMD_LIST_ARENAS)
+        {
+            drop_held(session);
+            if (cmd.type == CMD_SELECT_ARENA)
+                strcpy(session->name, cmd.name);
+            else if (cmd.type == CMD_ALLOC_ARENA)
+                session_alloc_arena(session, session->name, cmd.size, NULL, out);
+            else if (cmd.type == CMD_ALLOC_ARENA_FILE)
+                session_alloc_arena(session, session->name, cmd.size, cmd.path, out);
+            else if (cmd.type == CMD_CREATE_ARENA)
+                session_alloc_arena(session, cmd.name, cmd.size, NULL, out);
+            else if (cmd.type == CMD_DEALLOC_ARENA)
+                session_dealloc_arena(session, session->name, out);
+            else if (cmd.type == CMD_DESTROY_ARENA)
+                session_dealloc_arena(session, cmd.name, out);
+            else
+                session_list_arenas(session, out);
+            continue;
+        }
+
+        if (cmd.type == CMD_INVALID)
+        {
+            strbuf_printf(out, "Invalid command. Please try again.\n");
+            continue;
+        }
+
+        if (session->held == NULL)
+        {
+            session->held = acquire_entry(session->table, session->name);
+            if (session->held == NULL)
+            {
+                strbuf_printf(out, "Arena %s does not exist.\n", session->name);
+                free(cmd.data);
+                continue;
+            }
+            pthread_mutex_lock(&entry_state(session->held)->lock);
+        }
+
+        execute_command(&session->held->arena, &cmd, out);
+    }
+
+    drop_held(session);
+    return consumed;
+}
+
+// Function to delete a session (its arenas stay in the table)
+void delete_session(session_t *session)
+{
+    if (session == NULL)
+        return;
+    drop_held(session);
+    free(session);
+}
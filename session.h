@@ -0,0 +1,18 @@
+#pragma once
+#include "strbuf.h"
+
+// Opaque table of named arenas shared by every session of a server
+typedef struct arena_table_t arena_table_t;
+
+// Opaque state of one client: its selected arena and the arena it holds locked
+typedef struct session_t session_t;
+
+// Function prototypes for the table of named arenas
+arena_table_t *create_arena_table(void);
+void delete_arena_table(arena_table_t *table);
+
+// Function prototypes for running client commands
+session_t *create_session(arena_table_t *table);
+size_t session_feed(session_t *session, const char *buf, size_t len, int eof,
+					strbuf_t *out);
+void delete_session(session_t *session);
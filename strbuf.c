@@ -0,0 +1,104 @@
+#include "strbuf.h" // Include the header file for the output buffers
+
+// Function to create an empty buffer with room for cap bytes
+strbuf_t *create_strbuf(size_t cap)
+{
+    strbuf_t *sb = malloc(sizeof(strbuf_t));
+
+    if (sb == NULL)
+        return NULL;
+    sb->cap = cap > 0 ? cap : 64;
+    sb->data = malloc(sb->cap);
+    sb->len = 0;
+    if (sb->data == NULL)
+    {
+        free(sb);
+        return NULL;
+    }
+    return sb;
+}
+
+// Function to make sure the buffer can take extra more bytes without growing again,
+// returns 0 and leaves the buffer as it was if the host is out of memory
+int strbuf_reserve(strbuf_t *sb, size_t extra)
+{
+    size_t cap = sb->cap;
+    char *data = NULL;
+
+    if (extra <= sb->cap - sb->len)
+        return 1;
+    if (extra > SIZE_MAX / 2 - sb->len)
+        return 0;
+
+    // Grow geometrically so appends stay amortized O(1)
+    while (sb->len + extra > cap)
+        cap *= 2;
+    data = realloc(sb->data, cap);
+    if (data == NULL)
+        return 0;
+    sb->data = data;
+    sb->cap = cap;
+    return 1;
+}
+
+// Function to append raw bytes to the buffer
+void strbuf_append(strbuf_t *sb, const void *data, size_t size)
+{
+    if (sb == NULL)
+    {
+        fwrite(data, 1, size, stdout);
+        return;
+    }
+
+    if (!strbuf_reserve(sb, size))
+        return;
+    memcpy(sb->data + sb->len, data, size);
+    sb->len += size;
+}
+
+// Function to append formatted text to the buffer
+void strbuf_printf(strbuf_t *sb, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    strbuf_vprintf(sb, format, args);
+    va_end(args);
+}
+
+// Function to append formatted text to the buffer, taking a va_list
+void strbuf_vprintf(strbuf_t *sb, const char *format, va_list args)
+{
+    va_list copy;
+    int needed = 0;
+
+    if (sb == NULL)
+    {
+        vprintf(format, args);
+        return;
+    }
+
+    // Try to format in place first, and grow only if the text did not fit
+    va_copy(copy, args);
+    needed = vsnprintf(sb->data + sb->len, sb->cap - sb->len, format, copy);
+    va_end(copy);
+    if (needed < 0)
+        return;
+
+    if ((size_t)needed >= sb->cap - sb->len)
+    {
+        if (!strbuf_reserve(sb, (size_t)needed + 1))
+            return;
+        vsnprintf(sb->data + sb->len, sb->cap - sb->len, format, args);
+    }
+    sb->len += needed;
+}
+
+// Function to free a buffer and its data
+void delete_strbuf(strbuf_t *sb)
+{
+    if (sb == NULL)
+        return;
+    free(sb->data);
+    free(sb);
+}
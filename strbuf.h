@@ -0,0 +1,24 @@
+#pragma once
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Definition of a growable byte buffer used to collect command output.
+// Every function accepts a NULL buffer, which stands for stdout.
+typedef struct
+{
+	char *data;
+	size_t len;
+	size_t cap;
+} strbuf_t;
+
+// Function prototypes for creating, filling and deleting buffers
+strbuf_t *create_strbuf(size_t cap);
+int strbuf_reserve(strbuf_t *sb, size_t extra);
+void strbuf_append(strbuf_t *sb, const void *data, size_t size);
+void strbuf_printf(strbuf_t *sb, const char *format, ...);
+void strbuf_vprintf(strbuf_t *sb, const char *format, va_list args);
+void delete_strbuf(strbuf_t *sb);
@@ -0,0 +1,84 @@
+#define _GNU_SOURCE // For MSG_NOSIGNAL
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Test client for make check: sends stdin to the server listening on a Unix domain socket
+// and copies the replies to stdout until the server closes the connection
+int main(int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    struct pollfd fds[2];
+    char buf[1 << 16];
+    ssize_t pending = 0, sent = 0, got = 0;
+    int sock = -1;
+    int sending = 1;
+
+    if (argc != 2 || strlen(argv[1]) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Usage: %s <socket path>\n", argv[0]);
+        return 2;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, argv[1]);
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    // Send and receive at once, so a server that replies while we still write never stalls
+    fds[0].events = POLLIN;
+    fds[1].fd = sock;
+    for (;;)
+    {
+        fds[0].fd = sending && pending == 0 ? STDIN_FILENO : -1; // Negative entries are skipped
+        fds[0].revents = 0;
+        fds[1].events = POLLIN | (pending > 0 ? POLLOUT : 0);
+        if (poll(fds, 2, -1) < 0)
+            break;
+
+        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            char reply[1 << 16];
+
+            got = recv(sock, reply, sizeof(reply), 0);
+            if (got <= 0)
+                break;
+            fwrite(reply, 1, got, stdout);
+        }
+        if (pending > 0 && (fds[1].revents & POLLOUT))
+        {
+            got = send(sock, buf + sent, pending - sent, MSG_NOSIGNAL);
+            if (got < 0)
+            {
+                // The server closed its side, its last replies are still to be read
+                pending = 0;
+                sending = 0;
+                continue;
+            }
+            sent += got;
+            if (sent == pending)
+                pending = sent = 0;
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP))
+        {
+            pending = read(STDIN_FILENO, buf, sizeof(buf));
+            if (pending <= 0)
+            {
+                pending = 0;
+                sending = 0;
+                shutdown(sock, SHUT_WR);
+            }
+        }
+    }
+
+    close(sock);
+    return 0;
+}
@@ -0,0 +1,50 @@
+#define _GNU_SOURCE // For MAP_ANONYMOUS
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Program traced by make check: makes the same allocations on every run, with each call the
+// tracer records, then forks a child that allocates and frees blocks of its own
+int main(void)
+{
+    char *blocks[64];
+    void *aligned = NULL;
+    char *map = NULL;
+    pid_t child = 0;
+
+    for (int i = 0; i < 64; i++)
+        blocks[i] = malloc(16 + i * 24);
+    for (int i = 0; i < 64; i += 2)
+        free(blocks[i]);
+    for (int i = 1; i < 64; i += 4)
+        blocks[i] = realloc(blocks[i], 4096 + i);
+    blocks[0] = calloc(100, 8);
+    if (posix_memalign(&aligned, 256, 1000) != 0)
+        return 1;
+    blocks[2] = aligned_alloc(64, 640);
+
+    map = mmap(NULL, 65536, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return 1;
+    mprotect(map, 4096, PROT_READ);
+    munmap(map, 65536);
+
+    // The child's records go to a trace of its own
+    child = fork();
+    if (child == 0)
+    {
+        for (int i = 0; i < 8; i++)
+            free(malloc(100 * (i + 1)));
+        exit(0);
+    }
+    if (child > 0)
+        waitpid(child, NULL, 0);
+
+    free(aligned);
+    free(blocks[0]);
+    free(blocks[2]);
+    for (int i = 1; i < 64; i += 2)
+        free(blocks[i]);
+    return child > 0 ? 0 : 1;
+}
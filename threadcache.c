@@ -0,0 +1,494 @@
+#include "threadcache.h" // Include the header file for the size-class front end
+#include "vma_internal.h"
+
+// Function to get the size class of a request of at most VMA_CACHE_MAX_SIZE bytes
+static int size_class(const uint64_t size)
+{
+    uint64_t last = size - 1;
+    int top = 63 - __builtin_clzll(last | 1);
+
+    if (size <= 128)
+        return (size + 15) / 16 - 1;
+
+    // Four classes between each power of two and the next
+    return 8 + (top - 7) * 4 + ((last >> (top - 2)) & 3);
+}
+
+// Function to get the size of the objects of a class
+static uint64_t class_size(const int index)
+{
+    uint64_t base = 0;
+
+    if (index < 8)
+        return (uint64_t)(index + 1) * 16;
+    base = 128ull << ((index - 8) / 4);
+    return base + ((index - 8) % 4 + 1) * (base / 4);
+}
+
+// Function to get the number of objects moved between a thread cache and the central lists
+// at once, about 64 KiB worth
+static uint32_t batch_size(const int index)
+{
+    uint64_t count = 65536 / class_size(index);
+
+    return count < 2 ? 2 : count > 32 ? 32 : count;
+}
+
+// Function to add to a counter that other threads may read
+static void bump(uint64_t *counter, const int64_t delta)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + delta, __ATOMIC_RELAXED);
+}
+
+// Value of an empty slot of an object set
+#define NO_OBJECT UINT64_MAX
+
+// Function to hash an object address into an object set
+static size_t object_hash(const uint64_t address)
+{
+    return (size_t)(((address / VMA_CACHE_ALIGN) * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+// Function to set up an empty object set with room for capacity objects, returns 0 if the
+// host is out of memory
+static int set_init(vma_object_set_t *set, const size_t capacity)
+{
+    size_t count = 16;
+    size_t i;
+
+    // Kept at most half full, so probe sequences stay short
+    while (count < 2 * capacity)
+        count *= 2;
+    set->slots = malloc(count * sizeof(uint64_t));
+    if (set->slots == NULL)
+        return 0;
+    for (i = 0; i < count; i++)
+        set->slots[i] = NO_OBJECT;
+    set->mask = count - 1;
+    set->count = 0;
+    return 1;
+}
+
+// Function to find the slot holding an address, or the empty slot that ends its probe sequence
+static size_t set_find(const vma_object_set_t *set, const uint64_t address)
+{
+    size_t i = object_hash(address) & set->mask;
+
+    while (set->slots[i] != NO_OBJECT && set->slots[i] != address)
+        i = (i + 1) & set->mask;
+    return i;
+}
+
+// Function to check whether an object set holds an address
+static int set_holds(const vma_object_set_t *set, const uint64_t address)
+{
+    return set->slots[set_find(set, address)] == address;
+}
+
+// Function to add an address to an object set, which must have room for it
+static void set_add(vma_object_set_t *set, const uint64_t address)
+{
+    size_t i = set_find(set, address);
+
+    if (set->slots[i] == NO_OBJECT)
+    {
+        set->slots[i] = address;
+        set->count++;
+    }
+}
+
+// Function to remove an address from an object set. The addresses probed past it move back
+// into the hole when it lies on their probe sequence, so no slot is left marked as deleted.
+static void set_remove(vma_object_set_t *set, const uint64_t address)
+{
+    size_t hole = set_find(set, address);
+    size_t i = hole;
+    size_t home = 0;
+
+    if (set->slots[hole] != address)
+        return;
+    set->count--;
+    for (i = (i + 1) & set->mask; set->slots[i] != NO_OBJECT; i = (i + 1) & set->mask)
+    {
+        home = object_hash(set->slots[i]) & set->mask;
+        if (((i - home) & set->mask) >= ((i - hole) & set->mask))
+        {
+            set->slots[hole] = set->slots[i];
+            hole = i;
+        }
+    }
+    set->slots[hole] = NO_OBJECT;
+}
+
+// Function to make room in an object set for capacity objects, returns 0 if the host is
+// out of memory
+static int set_reserve(vma_object_set_t *set, const size_t capacity)
+{
+    vma_object_set_t grown;
+    size_t i;
+
+    if (2 * capacity <= set->mask + 1)
+        return 1;
+    if (!set_init(&grown, capacity))
+        return 0;
+    for (i = 0; i <= set->mask; i++)
+        if (set->slots[i] != NO_OBJECT)
+            set_add(&grown, set->slots[i]);
+    free(set->slots);
+    *set = grown;
+    return 1;
+}
+
+// Function to make room for count more objects in a central list, with the lock held
+static int central_reserve(vma_central_t *central, const int index, const size_t count)
+{
+    size_t capacity = central->capacities[index];
+    uint64_t *objects = NULL;
+
+    if (!set_reserve(&central->held, central->held.count + count))
+        return 0;
+    if (central->counts[index] + count <= capacity)
+        return 1;
+    while (capacity < central->counts[index] + count)
+        capacity = capacity > 0 ? capacity * 2 : 64;
+    objects = realloc(central->objects[index], capacity * sizeof(uint64_t));
+    if (objects == NULL)
+        return 0;
+    central->objects[index] = objects;
+    central->capacities[index] = capacity;
+    return 1;
+}
+
+// Function to carve a batch of objects out of the arena into a central list, with the lock
+// held. Objects are allocated one after another, so they merge into a block of miniblocks.
+static vma_status_t central_carve(vma_central_t *central, const int index, const uint32_t count)
+{
+    uint64_t size = class_size(index);
+    uint64_t address = 0;
+    vma_status_t status = VMA_OK;
+    uint32_t i;
+
+    if (!central_reserve(central, index, count))
+        return VMA_ERR_NO_MEMORY;
+    for (i = 0; i < count; i++)
+    {
+        // Keep going after the previous object, or find a new zone when that one is taken
+        if (i == 0 || vma_alloc_block(central->arena, address + size, size) != VMA_OK)
+            status = vma_malloc(central->arena, size, VMA_CACHE_ALIGN, &address);
+        else
+            address += size;
+        if (status != VMA_OK)
+            break;
+        central->objects[index][central->counts[index]++] = address;
+        set_add(&central->held, address);
+        central->held_bytes += size;
+        central->carved_bytes += size;
+    }
+    return i > 0 ? VMA_OK : status; // A partial batch still serves the request
+}
+
+// Function to create the central lists of an arena, along with the caller's thread cache
+vma_central_t *vma_central_create(arena_t *arena)
+{
+    vma_central_t *central = calloc(1, sizeof(vma_central_t));
+
+    if (central == NULL)
+        return NULL;
+    central->arena = arena;
+    if (!set_init(&central->held, 0))
+    {
+        free(central);
+        return NULL;
+    }
+    pthread_mutex_init(&central->lock, NULL);
+    central->main_cache = vma_cache_create(central);
+    if (central->main_cache == NULL)
+    {
+        pthread_mutex_destroy(&central->lock);
+        free(central->held.slots);
+        free(central);
+        return NULL;
+    }
+    arena->central = central;
+    return central;
+}
+
+// Function to get the central lists of an arena, NULL until they are created
+vma_central_t *vma_central_get(const arena_t *arena)
+{
+    return arena->central;
+}
+
+// Function to delete the central lists and every thread cache, freeing the objects they hold;
+// the threads must be done with their caches. An arena being deleted detaches itself first
+// (arena set to NULL), as its objects go along with it.
+void vma_central_destroy(vma_central_t *central)
+{
+    int i;
+
+    while (central->caches != NULL)
+        vma_cache_destroy(central->caches);
+    for (i = 0; i < VMA_CACHE_CLASSES; i++)
+    {
+        while (central->arena != NULL && central->counts[i] > 0)
+            vma_free_block(central->arena, central->objects[i][--central->counts[i]]);
+        free(central->objects[i]);
+    }
+    free(central->held.slots);
+    if (central->arena != NULL)
+        central->arena->central = NULL;
+    pthread_mutex_destroy(&central->lock);
+    free(central);
+}
+
+// Function to create a thread cache, which only the calling thread may use
+vma_thread_cache_t *vma_cache_create(vma_central_t *central)
+{
+    vma_thread_cache_t *cache = calloc(1, sizeof(vma_thread_cache_t));
+    size_t capacity = 0;
+    int i;
+
+    if (cache == NULL)
+        return NULL;
+    cache->central = central;
+    for (i = 0; i < VMA_CACHE_CLASSES; i++)
+    {
+        cache->lists[i].capacity = 2 * batch_size(i);
+        cache->lists[i].objects = malloc(cache->lists[i].capacity * sizeof(uint64_t));
+        capacity += cache->lists[i].capacity;
+        if (cache->lists[i].objects == NULL)
+            break;
+    }
+    if (i < VMA_CACHE_CLASSES || !set_init(&cache->held, capacity))
+    {
+        for (i = 0; i < VMA_CACHE_CLASSES; i++)
+            free(cache->lists[i].objects);
+        free(cache);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&central->lock);
+    cache->next = central->caches;
+    if (central->caches != NULL)
+        central->caches->prev = cache;
+    central->caches = cache;
+    pthread_mutex_unlock(&central->lock);
+    return cache;
+}
+
+// Function to move count objects from the top of a thread cache list to the central lists,
+// with the lock held
+static void cache_release(vma_thread_cache_t *cache, const int index, uint32_t count)
+{
+    vma_central_t *central = cache->central;
+    vma_cache_list_t *list = &cache->lists[index];
+    uint64_t size = class_size(index);
+
+    // Objects that cannot be listed centrally go back to the arena instead (if it is not
+    // being deleted anyway)
+    if (!central_reserve(central, index, count))
+    {
+        for (; count > 0; count--)
+        {
+            if (central->arena != NULL)
+                vma_free_block(central->arena, list->objects[list->count - 1]);
+            set_remove(&cache->held, list->objects[--list->count]);
+            bump(&cache->counters.held_bytes, -(int64_t)size);
+        }
+        return;
+    }
+    for (; count > 0; count--)
+    {
+        central->objects[index][central->counts[index]++] = list->objects[--list->count];
+        set_remove(&cache->held, list->objects[list->count]);
+        set_add(&central->held, list->objects[list->count]);
+        central->held_bytes += size;
+        bump(&cache->counters.held_bytes, -(int64_t)size);
+    }
+}
+
+// Function to give the objects of a thread cache back to the central lists and delete it
+void vma_cache_destroy(vma_thread_cache_t *cache)
+{
+    vma_central_t *central = cache->central;
+    int i;
+
+    pthread_mutex_lock(&central->lock);
+    for (i = 0; i < VMA_CACHE_CLASSES; i++)
+    {
+        cache_release(cache, i, cache->lists[i].count);
+        free(cache->lists[i].objects);
+    }
+    free(cache->held.slots);
+    central->retired.hits += cache->counters.hits;
+    central->retired.misses += cache->counters.misses;
+    central->retired.large += cache->counters.large;
+    if (cache->prev != NULL)
+        cache->prev->next = cache->next;
+    else
+        central->caches = cache->next;
+    if (cache->next != NULL)
+        cache->next->prev = cache->prev;
+    if (central->main_cache == cache)
+        central->main_cache = NULL;
+    pthread_mutex_unlock(&central->lock);
+    free(cache);
+}
+
+// Function to fill an empty thread cache list with a batch from the central lists
+static vma_status_t cache_refill(vma_thread_cache_t *cache, const int index)
+{
+    vma_central_t *central = cache->central;
+    vma_cache_list_t *list = &cache->lists[index];
+    uint64_t size = class_size(index);
+    uint32_t batch = batch_size(index);
+    vma_status_t status = VMA_OK;
+
+    pthread_mutex_lock(&central->lock);
+    if (central->counts[index] < batch)
+        status = central_carve(central, index, batch - central->counts[index]);
+    while (list->count < batch && central->counts[index] > 0)
+    {
+        list->objects[list->count++] = central->objects[index][--central->counts[index]];
+        set_remove(&central->held, list->objects[list->count - 1]);
+        set_add(&cache->held, list->objects[list->count - 1]);
+        central->held_bytes -= size;
+        bump(&cache->counters.held_bytes, size);
+    }
+    pthread_mutex_unlock(&central->lock);
+    return list->count > 0 ? VMA_OK : status;
+}
+
+// Function to allocate size bytes through a thread cache. Small sizes are rounded up to
+// their class and served without locking while the cache has objects of that class.
+vma_status_t vma_cache_alloc(vma_thread_cache_t *cache, const uint64_t size, uint64_t *address)
+{
+    vma_central_t *central = cache->central;
+    vma_cache_list_t *list = NULL;
+    vma_status_t status = VMA_OK;
+    int index = 0;
+
+    if (size > VMA_CACHE_MAX_SIZE)
+    {
+        bump(&cache->counters.large, 1);
+        pthread_mutex_lock(&central->lock);
+        status = vma_malloc(central->arena, size, VMA_CACHE_ALIGN, address);
+        pthread_mutex_unlock(&central->lock);
+        return status;
+    }
+
+    index = size_class(size > 0 ? size : 1);
+    list = &cache->lists[index];
+    if (list->count > 0)
+    {
+        bump(&cache->counters.hits, 1);
+    }
+    else
+    {
+        bump(&cache->counters.misses, 1);
+        status = cache_refill(cache, index);
+        if (status != VMA_OK)
+            return status;
+    }
+    *address = list->objects[--list->count];
+    set_remove(&cache->held, *address);
+    bump(&cache->counters.held_bytes, -(int64_t)class_size(index));
+    return VMA_OK;
+}
+
+// Function to free an object allocated through a thread cache with the given size; it stays
+// in the cache, which hands a batch to the central lists once it holds two
+vma_status_t vma_cache_free(vma_thread_cache_t *cache, const uint64_t address, const uint64_t size)
+{
+    vma_central_t *central = cache->central;
+    vma_cache_list_t *list = NULL;
+    vma_status_t status = VMA_OK;
+    int index = 0;
+
+    if (size > VMA_CACHE_MAX_SIZE)
+    {
+        pthread_mutex_lock(&central->lock);
+        status = vma_free_block(central->arena, address);
+        pthread_mutex_unlock(&central->lock);
+        return status;
+    }
+
+    index = size_class(size > 0 ? size : 1);
+    list = &cache->lists[index];
+    if (list->count == list->capacity)
+    {
+        pthread_mutex_lock(&central->lock);
+        cache_release(cache, index, batch_size(index));
+        pthread_mutex_unlock(&central->lock);
+    }
+    list->objects[list->count++] = address;
+    set_add(&cache->held, address);
+    bump(&cache->counters.held_bytes, class_size(index));
+    return VMA_OK;
+}
+
+// Function to check that a free would be valid: the address must be an object of that size
+// which is not already free in the cache or the central lists. It takes the lock, for
+// callers that cannot trust their input.
+vma_status_t vma_cache_check(vma_thread_cache_t *cache, const uint64_t address, const uint64_t size)
+{
+    vma_central_t *central = cache->central;
+    vma_status_t status = VMA_OK;
+    uint64_t found = 0;
+
+    pthread_mutex_lock(&central->lock);
+    status = vma_miniblock_size(central->arena, address, &found);
+    if (status == VMA_OK && size <= VMA_CACHE_MAX_SIZE)
+    {
+        if (found != class_size(size_class(size > 0 ? size : 1)) || set_holds(&cache->held, address) ||
+            set_holds(&central->held, address))
+            status = VMA_ERR_INVALID_ADDRESS;
+    }
+    else if (status == VMA_OK && found != size)
+    {
+        status = VMA_ERR_INVALID_ADDRESS;
+    }
+    pthread_mutex_unlock(&central->lock);
+    return status;
+}
+
+// Function to check whether an address is a free object waiting in the central lists or in
+// any thread cache. Such objects are still allocated in the arena, so callers that change
+// blocks directly use this to leave them alone; the other threads must not be using their
+// caches meanwhile.
+int vma_cache_holds(vma_central_t *central, const uint64_t address)
+{
+    vma_thread_cache_t *cache = NULL;
+    int held = 0;
+
+    // One lookup in the central lists and one per thread cache
+    pthread_mutex_lock(&central->lock);
+    held = set_holds(&central->held, address);
+    for (cache = central->caches; !held && cache != NULL; cache = cache->next)
+        held = set_holds(&cache->held, address);
+    pthread_mutex_unlock(&central->lock);
+    return held;
+}
+
+// Function to add up the counters of the central lists and every thread cache
+void vma_cache_stats(vma_central_t *central, vma_cache_stats_t *stats)
+{
+    vma_thread_cache_t *cache = NULL;
+
+    memset(stats, 0, sizeof(vma_cache_stats_t));
+    pthread_mutex_lock(&central->lock);
+    stats->hits = central->retired.hits;
+    stats->misses = central->retired.misses;
+    stats->large = central->retired.large;
+    for (cache = central->caches; cache != NULL; cache = cache->next)
+    {
+        stats->hits += __atomic_load_n(&cache->counters.hits, __ATOMIC_RELAXED);
+        stats->misses += __atomic_load_n(&cache->counters.misses, __ATOMIC_RELAXED);
+        stats->large += __atomic_load_n(&cache->counters.large, __ATOMIC_RELAXED);
+        stats->thread_bytes += __atomic_load_n(&cache->counters.held_bytes, __ATOMIC_RELAXED);
+        stats->cache_count++;
+    }
+    stats->central_bytes = central->held_bytes;
+    stats->carved_bytes = central->carved_bytes;
+    pthread_mutex_unlock(&central->lock);
+}
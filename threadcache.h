@@ -0,0 +1,89 @@
+#pragma once
+#include <pthread.h>
+
+#include "vma.h"
+
+// Largest size served by the size classes; larger requests go to the arena directly
+#define VMA_CACHE_MAX_SIZE 4096
+// Number of size classes: every 16 bytes up to 128, then four per power of two
+#define VMA_CACHE_CLASSES 28
+// Alignment of every object
+#define VMA_CACHE_ALIGN 16
+
+// Definition of a set of object addresses, open-addressed with linear probing
+typedef struct
+{
+	uint64_t *slots; // UINT64_MAX marks an empty slot, which no aligned object starts at
+	size_t mask;	 // Number of slots - 1, a power of two
+	size_t count;
+} vma_object_set_t;
+
+// Definition of the free objects of one size class in a thread cache, used as a stack
+typedef struct
+{
+	uint64_t *objects;
+	uint32_t count;
+	uint32_t capacity; // Two batches; a full list hands one back to the central lists
+} vma_cache_list_t;
+
+// Definition of the counters of a thread cache, written only by its own thread
+typedef struct
+{
+	uint64_t hits;		 // Small allocations served by the cache
+	uint64_t misses;	 // Small allocations that had to fetch a batch from the central lists
+	uint64_t large;		 // Allocations past VMA_CACHE_MAX_SIZE
+	uint64_t held_bytes; // Bytes of the free objects in the cache
+} vma_cache_counters_t;
+
+// Definition of the cache of one thread; only that thread may use it
+typedef struct vma_thread_cache_t
+{
+	struct vma_central_t *central;
+	vma_cache_list_t lists[VMA_CACHE_CLASSES];
+	vma_cache_counters_t counters;
+	vma_object_set_t held; // Every object in the lists, sized for all of them at once
+	struct vma_thread_cache_t *prev; // Every cache of the central, for the stats
+	struct vma_thread_cache_t *next;
+} vma_thread_cache_t;
+
+// Definition of the central free lists of an arena. Objects are miniblocks carved out of
+// the arena a batch at a time; they stay allocated while they wait in a list.
+typedef struct vma_central_t
+{
+	arena_t *arena;
+	pthread_mutex_t lock; // Guards the lists, the caches and the arena itself
+	uint64_t *objects[VMA_CACHE_CLASSES];
+	size_t counts[VMA_CACHE_CLASSES];
+	size_t capacities[VMA_CACHE_CLASSES];
+	vma_object_set_t held;	// Every object in the lists, grown along with them
+	uint64_t held_bytes;	// Bytes of the free objects in the central lists
+	uint64_t carved_bytes;	// Bytes of objects carved out of the arena so far
+	vma_cache_counters_t retired; // Counters of the caches deleted so far
+	vma_thread_cache_t *caches;
+	vma_thread_cache_t *main_cache; // Cache of the thread that created the central lists
+} vma_central_t;
+
+// Definition of the totals of the central lists and every thread cache
+typedef struct
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t large;
+	uint64_t thread_bytes;	// Bytes of free objects in thread caches
+	uint64_t central_bytes; // Bytes of free objects in the central lists
+	uint64_t carved_bytes;
+	size_t cache_count;
+} vma_cache_stats_t;
+
+// Function prototypes for the size-class front end. While it exists, the arena must only be
+// changed through it, or with the central lock held. Frees must give the size allocated.
+vma_central_t *vma_central_create(arena_t *arena);
+vma_central_t *vma_central_get(const arena_t *arena);
+void vma_central_destroy(vma_central_t *central);
+vma_thread_cache_t *vma_cache_create(vma_central_t *central);
+void vma_cache_destroy(vma_thread_cache_t *cache);
+vma_status_t vma_cache_alloc(vma_thread_cache_t *cache, const uint64_t size, uint64_t *address);
+vma_status_t vma_cache_free(vma_thread_cache_t *cache, const uint64_t address, const uint64_t size);
+vma_status_t vma_cache_check(vma_thread_cache_t *cache, const uint64_t address, const uint64_t size);
+int vma_cache_holds(vma_central_t *central, const uint64_t address);
+void vma_cache_stats(vma_central_t *central, vma_cache_stats_t *stats);
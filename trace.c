@@ -0,0 +1,157 @@
+#include "trace.h" // Include the header file for the allocation traces
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vma.h"
+
+// Definition of a record of a binary trace, once decoded
+typedef struct
+{
+    uint64_t seq;
+    uint64_t address;
+    uint64_t size;
+    uint8_t type;
+    uint8_t perm;
+} trace_record_t;
+
+// Function to read a varint, returns 0 at the end of the input
+static int read_varint(FILE *in, uint64_t *value)
+{
+    int byte = 0;
+    int shift = 0;
+
+    *value = 0;
+    do
+    {
+        byte = fgetc(in);
+        if (byte == EOF || shift > 63)
+            return 0;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return 1;
+}
+
+// Function to order records by sequence number
+static int compare_seq(const void *a, const void *b)
+{
+    const trace_record_t *x = a;
+    const trace_record_t *y = b;
+
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// Function to print the permissions of an MPROTECT the way the command reads them
+static void print_perm(FILE *out, const uint8_t perm)
+{
+    const char *names[] = {"PROT_READ", "PROT_WRITE", "PROT_EXEC"};
+    const uint8_t bits[] = {VMA_PROT_READ, VMA_PROT_WRITE, VMA_PROT_EXEC};
+    int first = 1;
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (!(perm & bits[i]))
+            continue;
+        fprintf(out, "%s%s", first ? "" : " | ", names[i]);
+        first = 0;
+    }
+    if (first)
+        fprintf(out, "PROT_NONE");
+}
+
+// Function to read the next record of a chunk, returns 0 if the trace ends before it does
+static int read_record(FILE *in, uint64_t *seq, uint64_t *address, trace_record_t *record)
+{
+    uint64_t delta = 0;
+    int type = fgetc(in);
+    int perm = 0;
+
+    if (type < TRACE_ALLOC || type > TRACE_MPROTECT || !read_varint(in, &delta))
+        return 0;
+    *seq += delta;
+    if (!read_varint(in, &delta))
+        return 0;
+    *address += (delta >> 1) ^ -(delta & 1); // Undo the zigzag
+
+    record->seq = *seq;
+    record->type = type;
+    record->address = *address;
+    record->size = 0;
+    record->perm = 0;
+    if (type == TRACE_ALLOC && !read_varint(in, &record->size))
+        return 0;
+    if (type == TRACE_MPROTECT)
+    {
+        perm = fgetc(in);
+        if (perm == EOF)
+            return 0;
+        record->perm = perm;
+    }
+    return 1;
+}
+
+// Function to decode a binary trace into commands. Each thread's records were written out
+// by that thread, so they are sorted back into the order the calls were made in. A process
+// that was killed leaves its last chunk unfinished, which ends the trace. Returns 1 if the
+// input is not a binary trace and 2 if the host is out of memory, printing nothing then.
+int decode_trace(FILE *in, FILE *out)
+{
+    char magic[TRACE_MAGIC_SIZE];
+    trace_record_t *records = NULL;
+    trace_record_t *grown = NULL;
+    trace_record_t *record = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    uint64_t seq = 0;
+    uint64_t chunk_count = 0;
+    uint64_t length = 0;
+    uint64_t address = 0;
+    int complete = 1;
+
+    if (fread(magic, 1, TRACE_MAGIC_SIZE, in) != TRACE_MAGIC_SIZE ||
+        memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0)
+        return 1;
+
+    while (complete && read_varint(in, &seq) && read_varint(in, &chunk_count) &&
+           read_varint(in, &length))
+    {
+        address = 0;
+        for (uint64_t i = 0; complete && i < chunk_count; i++)
+        {
+            if (count == capacity)
+            {
+                capacity = capacity > 0 ? capacity * 2 : 4096;
+                grown = realloc(records, capacity * sizeof(trace_record_t));
+                if (grown == NULL)
+                {
+                    free(records);
+                    return 2;
+                }
+                records = grown;
+            }
+            complete = read_record(in, &seq, &address, &records[count]);
+            if (complete)
+                count++;
+        }
+    }
+
+    qsort(records, count, sizeof(trace_record_t), compare_seq);
+    fprintf(out, "ALLOC_ARENA %llu\n", TRACE_ARENA_SIZE);
+    for (size_t i = 0; i < count; i++)
+    {
+        record = &records[i];
+        if (record->type == TRACE_ALLOC)
+            fprintf(out, "ALLOC_BLOCK %" PRIu64 " %" PRIu64 "\n", record->address, record->size);
+        else if (record->type == TRACE_FREE)
+            fprintf(out, "FREE_BLOCK %" PRIu64 "\n", record->address);
+        else
+        {
+            fprintf(out, "MPROTECT %" PRIu64 " ", record->address);
+            print_perm(out, record->perm);
+            fputc('\n', out);
+        }
+    }
+    free(records);
+    return 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+
+// Size of the arena traces are replayed in, enough for any user-space address on x86-64
+#define TRACE_ARENA_SIZE 140737488355328ull
+
+// A binary trace starts with this, followed by chunks of records
+#define TRACE_MAGIC "VMATRACE"
+#define TRACE_MAGIC_SIZE 8
+
+// Types of the records of a binary trace. A chunk holds the records of one thread, as the
+// varints first sequence number, record count and byte count. Every record is a type byte,
+// the varint distance of its sequence number from the previous one's and the zigzag varint
+// distance of its address from the previous one's, then the size of an ALLOC_BLOCK as a
+// varint or the permissions of an MPROTECT as a byte.
+typedef enum
+{
+	TRACE_ALLOC = 1,
+	TRACE_FREE,
+	TRACE_MPROTECT
+} trace_record_type_t;
+
+// Function prototype for turning a binary trace back into commands, in call order; returns
+// 0 on success, 1 if the input is not a binary trace, 2 if the host is out of memory
+int decode_trace(FILE *in, FILE *out);
@@ -1,7 +1,13 @@
-#include "vma.h" // Include the header file containing data structures and function declarations
+#define _GNU_SOURCE // For madvise, MAP_ANONYMOUS and fallocate
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "vma_internal.h" // Include the header file containing data structures and function declarations
+#include "threadcache.h"
 
 // Function to create a new list
-list_t *create_list()
+static list_t *create_list(void)
 {
     // Allocate memory for the list structure
     list_t *list = malloc(sizeof(list_t));
@@ -12,884 +18,1884 @@ list_t *create_list()
     return list;
 }
 
-// Function to create a new node
-node_t *create_node()
+// Function to insert a node before next, or at the end of the list if next is NULL
+static void insert_node_before(list_t *list, node_t *next, node_t *new_node)
 {
-    // Allocate memory for the node structure
-    node_t *node = malloc(sizeof(node_t));
-    return node;
+    new_node->next = next;
+    new_node->prev = next != NULL ? next->prev : list->tail;
+
+    // Link the neighbours (or the list ends) to the new node
+    if (new_node->prev != NULL)
+        new_node->prev->next = new_node;
+    else
+        list->head = new_node;
+    if (next != NULL)
+        next->prev = new_node;
+    else
+        list->tail = new_node;
+}
+
+// Miniblocks are pooled in chunks of this many entries; index 0 is never handed out
+#define POOL_CHUNK_BITS 12
+#define POOL_CHUNK_SIZE (1u << POOL_CHUNK_BITS)
+
+// Sequential reads of a file-backed arena prefetch this many bytes past their end
+#define VMA_READAHEAD (1u << 20)
+
+// Accessors for the fields packed in miniblock_t.packed
+#define MB_PERM(mb) ((mb)->packed & 7)
+#define MB_PERM_AND(mb) (((mb)->packed >> 3) & 7)
+#define MB_COUNT(mb) ((mb)->packed >> 6)
+
+// Function to get the miniblock stored at an index of the arena's pool
+static miniblock_t *get_miniblock(const arena_t *arena, const mb_index_t index)
+{
+    return &arena->chunks[index >> POOL_CHUNK_BITS][index & (POOL_CHUNK_SIZE - 1)];
 }
 
-// Function to insert a node at the end of the list
-void insert_node_at_end(node_t **head, node_t **tail, node_t *new_node)
+// Function to take a miniblock from the pool, returns 0 if the host is out of memory
+static mb_index_t pool_alloc(arena_t *arena)
 {
-    // If the list is empty, set new_node as both head and tail
-    if (*head == NULL)
+    mb_index_t index = arena->pool_free;
+    miniblock_t **chunks = NULL;
+
+    // Reuse a released entry if there is one
+    if (index != 0)
     {
-        new_node->next = new_node->prev = NULL;
-        *head = new_node;
-        *tail = new_node;
-        return;
+        arena->pool_free = get_miniblock(arena, index)->left;
+        return index;
     }
 
-    // Insert new_node at the end of the list
-    (*tail)->next = new_node;
-    new_node->next = NULL;
-    new_node->prev = (*tail);
-    (*tail) = new_node;
+    // Otherwise hand out the next fresh entry, adding a chunk when the last one is full
+    if ((arena->pool_next >> POOL_CHUNK_BITS) == arena->chunk_count)
+    {
+        chunks = realloc(arena->chunks, (arena->chunk_count + 1) * sizeof(miniblock_t *));
+        if (chunks == NULL)
+            return 0;
+        arena->chunks = chunks;
+        arena->chunks[arena->chunk_count] = malloc(POOL_CHUNK_SIZE * sizeof(miniblock_t));
+        if (arena->chunks[arena->chunk_count] == NULL)
+            return 0;
+        arena->chunk_count++;
+    }
+    return arena->pool_next++;
 }
 
-// Function to insert a node at the beginning of the list
-void insert_node_at_begging(node_t **head, node_t *new_node)
+// Function to give a miniblock back to the pool
+static void pool_release(arena_t *arena, const mb_index_t index)
 {
-    // Insert new_node at the beginning of the list
-    new_node->prev = NULL;
-    new_node->next = (*head);
-    (*head)->prev = new_node;
-    (*head) = new_node;
+    get_miniblock(arena, index)->left = arena->pool_free;
+    arena->pool_free = index;
 }
 
-// Function to allocate a new arena with the specified size
-arena_t *alloc_arena(const uint64_t size)
+// Blocks are pooled in chunks of this many entries
+#define BLOCK_CHUNK_SIZE 256
+
+// Definition of a block together with the list node holding it, so both come from one pool
+typedef struct block_node_t
 {
-    // Allocate memory for the arena structure
-    arena_t *arena = malloc(sizeof(arena_t));
-    arena->arena_size = size;          // Set arena size
-    arena->alloc_list = create_list(); // Initialize allocation list using create_list() function
-    return arena;                      // Return the newly created arena
-}
+    node_t node; // First, so a node is also its entry
+    block_t block;
+} block_node_t;
 
-// Function to delete a list and its nodes, considering block or miniblock types
-void delete_list(node_t *head, int is_block_or_miniblock)
+// Function to take a block and its list node from the pool, returns NULL if the host is out of memory
+static node_t *block_alloc(arena_t *arena)
 {
-    node_t *temp;
+    block_node_t *entry = arena->block_free;
+    block_node_t **chunks = NULL;
 
-    // Iterate through the list and delete nodes and their data based on the type (block or miniblock)
-    while (head != NULL)
+    if (entry != NULL)
+    {
+        arena->block_free = (block_node_t *)entry->node.next;
+    }
+    else
     {
-        temp = head;
-        head = head->next;
+        // Hand out the next fresh entry, adding a chunk when the last one is full
+        if (arena->block_next == arena->block_chunk_count * BLOCK_CHUNK_SIZE)
+        {
+            chunks = realloc(arena->block_chunks, (arena->block_chunk_count + 1) * sizeof(block_node_t *));
+            if (chunks == NULL)
+                return NULL;
+            arena->block_chunks = chunks;
+            arena->block_chunks[arena->block_chunk_count] = malloc(BLOCK_CHUNK_SIZE * sizeof(block_node_t));
+            if (arena->block_chunks[arena->block_chunk_count] == NULL)
+                return NULL;
+            arena->block_chunk_count++;
+        }
+        entry = &arena->block_chunks[arena->block_next / BLOCK_CHUNK_SIZE][arena->block_next % BLOCK_CHUNK_SIZE];
+        arena->block_next++;
+    }
+    entry->node.data = &entry->block;
+    return &entry->node;
+}
 
-        // Check if the data in the node is block or miniblock and delete accordingly
-        if (is_block_or_miniblock == 1)
-            delete_node_data(temp, 1);
-        else
-            delete_node_data(temp, 0);
+// Function to give a block and its list node back to the pool
+static void block_release(arena_t *arena, node_t *node)
+{
+    node->next = (node_t *)arena->block_free;
+    arena->block_free = (block_node_t *)node;
+}
 
-        // Free the memory allocated for the current node
-        free(temp);
-    }
+// Function to get the bytes of a miniblock
+static uint8_t *miniblock_data(const arena_t *arena, const miniblock_t *miniblock)
+{
+#ifndef VMA_COMPACT
+    if (arena->flat == NULL)
+        return miniblock->rw_buffer;
+#endif
+    return arena->flat + miniblock->start_address;
 }
 
-// Function to delete data inside a node based on its type (block or miniblock)
-void delete_node_data(node_t *node, int is_block_or_miniblock)
+#ifndef VMA_COMPACT
+// Function to create the buffer of a miniblock kept on the heap, plain or paged
+static void *create_buffer(arena_t *arena, const uint64_t size)
 {
-    block_t *block = NULL;
-    miniblock_t *miniblock = NULL;
-    list_t *list = NULL;
+    if (arena->pages != NULL)
+        return create_page_table(arena->pages, size);
+    return calloc(1, size);
+}
 
-    // Check if the node contains a block or miniblock data based on the flag is_block_or_miniblock
-    if (is_block_or_miniblock == 1)
-    {
-        block = node->data;           // Set the block pointer to the data inside the node
-        list = block->miniblock_list; // Get the list of miniblocks from the block structure
-        delete_list(list->head, 0);   // Delete miniblocks in the miniblock list
-        free(block->miniblock_list);
-        free(block);
-    }
+// Function to free the buffer of a miniblock kept on the heap
+static void delete_buffer(arena_t *arena, void *buffer)
+{
+    if (arena->pages != NULL && buffer != NULL)
+        delete_page_table(arena->pages, buffer);
     else
-    {
-        miniblock = node->data; // Set the miniblock pointer to the data inside the node
-        free(miniblock->rw_buffer);
-        free(miniblock);
-    }
+        free(buffer);
 }
+#endif
 
-// Function to delete a node from a list
-void delete_node_from_list(list_t *list, node_t *node)
+// Function to copy bytes out of a miniblock, returns 0 if the host is out of memory (or
+// the swap file cannot be read)
+static int copy_out(arena_t *arena, miniblock_t *miniblock, const uint64_t offset, void *buffer,
+                    const uint64_t size)
 {
-    // Update pointers in the adjacent nodes to bypass the node to be deleted
-    if (node == list->head)
-    {
-        list->head = node->next; // Update the head of the list
-    }
-    if (node == list->tail)
+#ifndef VMA_COMPACT
+    if (arena->pages != NULL)
+        return page_table_read(arena->pages, miniblock->rw_buffer, offset, buffer, size);
+#endif
+    memcpy(buffer, miniblock_data(arena, miniblock) + offset, size);
+    return 1;
+}
+
+// Function to copy bytes into a miniblock, returns 0 if the host is out of memory (or
+// the swap file cannot be read)
+static int copy_in(arena_t *arena, miniblock_t *miniblock, const uint64_t offset, const void *data,
+                   const uint64_t size)
+{
+#ifndef VMA_COMPACT
+    if (arena->pages != NULL)
+        return page_table_write(arena->pages, miniblock->rw_buffer, offset, data, size);
+#endif
+    memcpy(miniblock_data(arena, miniblock) + offset, data, size);
+    return 1;
+}
+
+// Function to zero a range of the flat mapping, giving its whole pages back to the kernel
+static void zero_range(arena_t *arena, const uint64_t start, const uint64_t size)
+{
+    uint64_t end = start + size;
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    uint64_t first_page = (start + page - 1) / page * page;
+    uint64_t last_page = end / page * page;
+
+    if (first_page >= last_page)
     {
-        list->tail = node->prev; // Update the tail of the list
+        memset(arena->flat + start, 0, size);
+        return;
     }
-    if (node->prev != NULL)
+
+    // The partial pages at the edges are cleared by hand
+    memset(arena->flat + start, 0, first_page - start);
+    memset(arena->flat + last_page, 0, end - last_page);
+
+    // A file gets a hole punched in it, which also drops the pages from the mapping;
+    // anonymous pages are simply discarded and come back zeroed
+    if (arena->fd >= 0)
     {
-        node->prev->next = node->next; // Update next pointer of the previous node
+        if (fallocate(arena->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, first_page,
+                      last_page - first_page) != 0)
+            memset(arena->flat + first_page, 0, last_page - first_page); // No hole support
     }
-    if (node->next != NULL)
+    else
     {
-        node->next->prev = node->prev; // Update prev pointer of the next node
+        madvise(arena->flat + first_page, last_page - first_page, MADV_DONTNEED);
     }
-    free(node); // Free memory allocated for the node structure
 }
 
-// Function to deallocate memory occupied by an arena and its associated data structures
-void dealloc_arena(arena_t *arena)
+// Function to drop the data of a miniblock, so the range reads as zeroes when reallocated
+static void release_data(arena_t *arena, miniblock_t *miniblock)
 {
-    delete_list(arena->alloc_list->head, 1); // Delete the allocation list along with block and miniblock data
-    free(arena->alloc_list);
-    free(arena);
+#ifndef VMA_COMPACT
+    if (arena->flat == NULL)
+    {
+        delete_buffer(arena, miniblock->rw_buffer);
+        return;
+    }
+#endif
+    zero_range(arena, miniblock->start_address, miniblock->size);
 }
 
-// Function to check if a specific address range is already allocated in the arena
-int check_already_allocated(arena_t *arena, const uint64_t address, const uint64_t size)
+// Function to prefetch the pages after a read that continues where the previous one stopped
+static void advise_read(arena_t *arena, const uint64_t address, const uint64_t size)
 {
-    node_t *node_block = arena->alloc_list->head;
-    block_t *in_block;
-    uint64_t block_address;
-    uint64_t block_size;
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    uint64_t start = address / page * page;
+    uint64_t end = address + size + VMA_READAHEAD;
 
-    // Iterate through the nodes in the allocation list to check for overlapping address ranges
-    while (node_block != NULL)
+    // Only a file has anything to read ahead, and leaving the arena alone otherwise lets
+    // reads run side by side
+    if (arena->fd < 0)
+        return;
+    if (address == arena->read_next)
     {
-        in_block = node_block->data;             // Get the block structure from the node data
-        block_address = in_block->start_address; // Get the start address of the block
-        block_size = in_block->size;             // Get the size of the block
-
-        // Check if the given address range overlaps with the current block's address range
-        if (address < block_address && address + size > (block_address))
-        {
-            return 1; // Address range overlaps, return 1 indicating already allocated
-        }
-        if (address >= block_address && address < (block_address + block_size))
-        {
-            return 1; // Address range overlaps, return 1 indicating already allocated
-        }
-
-        node_block = node_block->next; // Move to the next node in the allocation list
+        if (end > arena->arena_size)
+            end = arena->arena_size;
+        madvise(arena->flat + start, end - start, MADV_WILLNEED);
     }
-
-    return 0; // Address range does not overlap with any allocated block, return 0 indicating not already allocated
+    arena->read_next = address + size;
 }
 
-// Function to check if there is a left neighbor block of the given address
-node_t *check_have_left_neighbour(arena_t *arena, const uint64_t address)
+// Function to decide whether the current access is one of the sampled ones
+static int heat_sample(arena_t *arena)
 {
-    node_t *node_block = arena->alloc_list->head; // Pointer to iterate through the allocation list
-    block_t *in_block;
-    uint64_t left_block_address = 0;
+    vma_heat_t *heat = arena->heat;
 
-    // If the arena contains only one block, return NULL as there is no left neighbor
-    if (arena->alloc_list->head == arena->alloc_list->tail)
-        return NULL;
+    if (heat == NULL || ++heat->tick < heat->sample_rate)
+        return 0;
+    heat->tick = 0;
+    return 1;
+}
 
-    // Iterate through the nodes in the allocation list to find the left neighbor block
-    while (node_block != NULL)
+// Function to add a sampled access of size bytes to a counter
+static void heat_count(const vma_heat_t *heat, vma_heat_counter_t *counter, const uint64_t size,
+                       const int write)
+{
+    if (write)
     {
-        in_block = node_block->data;
-        left_block_address = in_block->start_address + in_block->size; // Calculate start address of the
-                                                                       // potential left neighbor block
+        counter->writes += heat->sample_rate;
+        counter->write_bytes += size * heat->sample_rate;
+    }
+    else
+    {
+        counter->reads += heat->sample_rate;
+        counter->read_bytes += size * heat->sample_rate;
+    }
+}
 
-        // Check if the calculated left block address matches the given address
-        if (left_block_address == address)
-        {
-            return node_block; // Return the node containing the left neighbor block
-        }
+// Function to get the counter of a miniblock, growing the table up to the pool if needed
+static vma_heat_counter_t *heat_miniblock(arena_t *arena, const mb_index_t index)
+{
+    vma_heat_t *heat = arena->heat;
+    vma_heat_counter_t *miniblocks = NULL;
+    size_t capacity = heat->miniblock_capacity;
 
-        node_block = node_block->next; // Move to the next node in the allocation list
+    if (index >= capacity)
+    {
+        capacity = arena->chunk_count << POOL_CHUNK_BITS;
+        miniblocks = realloc(heat->miniblocks, capacity * sizeof(vma_heat_counter_t));
+        if (miniblocks == NULL)
+            return NULL;
+        memset(miniblocks + heat->miniblock_capacity, 0,
+               (capacity - heat->miniblock_capacity) * sizeof(vma_heat_counter_t));
+        heat->miniblocks = miniblocks;
+        heat->miniblock_capacity = capacity;
     }
-
-    return NULL; // No left neighbor block found, return NULL
+    return &heat->miniblocks[index];
 }
 
-// Function to check if there is a right neighbor block of the given address and size
-node_t *check_have_right_neighbour(arena_t *arena, const uint64_t address, const uint64_t size)
+// Function to record a sampled access of [address, address + size) inside a miniblock
+static void heat_record(arena_t *arena, const mb_index_t index, uint64_t address, uint64_t size,
+                        const int write)
 {
-    node_t *node_block = arena->alloc_list->head;
-    block_t *in_block;
-    uint64_t right_block_address = 0;
+    vma_heat_t *heat = arena->heat;
+    vma_heat_counter_t *counter = heat_miniblock(arena, index);
+    uint64_t bucket = 0;
+    uint64_t part = 0;
 
-    // If the arena contains only one block, return NULL as there is no right neighbor
-    if (node_block == arena->alloc_list->tail)
-        return NULL;
+    if (counter != NULL)
+        heat_count(heat, counter, size, write);
 
-    // Iterate through the nodes in the allocation list to find the right neighbor block
-    while (node_block != NULL)
+    // The range may straddle buckets, each one gets its share of the bytes
+    while (size > 0)
     {
-        in_block = node_block->data;                   // Get the block structure from the node data
-        right_block_address = in_block->start_address; // Get the start address of the current block
-
-        // Check if the calculated right block address matches the given address + size
-        if (right_block_address == (address + size))
-        {
-            return node_block; // Return the node containing the right neighbor block
-        }
-        node_block = node_block->next;
+        bucket = address / heat->bucket_size;
+        part = (bucket + 1) * heat->bucket_size - address;
+        if (part > size)
+            part = size;
+        heat_count(heat, &heat->buckets[bucket], part, write);
+        address += part;
+        size -= part;
     }
+}
+
+// Smallest number of entries the change log may hold before the last map is kept whole instead
+#define DIFF_LOG_MIN 4096
 
-    return NULL; // No right neighbor block found, return NULL
+// Function to hash the address of an entry into the set of logged ones
+static size_t change_hash(const vma_record_type_t type, const uint64_t start)
+{
+    return (size_t)(((start << 1 | (uint64_t)type) * 0x9E3779B97F4A7C15ull) >> 32);
 }
 
-// Function to allocate a block in the arena with the given address and size
-void alloc_block(arena_t *arena, const uint64_t address, const uint64_t size)
+// Function to find the slot of the set of logged entries holding an entry, or the empty slot it would take
+static size_t *change_slot(const arena_t *arena, const vma_record_type_t type, const uint64_t start)
 {
-    // Error checking for invalid allocation addresses and overlapping allocations
-    if (address >= arena->arena_size)
-    {
-        printf("The allocated address is outside the size of the arena\n");
-    }
-    else if (address + size > arena->arena_size)
-    {
-        printf("The end address is past the size of the arena\n");
-    }
-    else if (check_already_allocated(arena, address, size))
+    size_t mask = arena->change_slot_count - 1;
+    size_t i = change_hash(type, start) & mask;
+    const vma_change_t *change = NULL;
+
+    for (; arena->change_slots[i] != 0; i = (i + 1) & mask)
     {
-        printf("This zone was already allocated.\n");
+        change = &arena->changes[arena->change_slots[i] - 1];
+        if (change->type == type && change->start_address == start)
+            break;
     }
-    else
-    {
-        node_t *node_block = create_node();
+    return &arena->change_slots[i];
+}
 
-        // Update the size and data size of the large allocation list
-        arena->alloc_list->size++;
-        arena->alloc_list->data_size += size;
+// Function to double the set of logged entries, returns 0 if the host is out of memory
+static int grow_change_slots(arena_t *arena)
+{
+    size_t count = arena->change_slot_count > 0 ? arena->change_slot_count * 2 : 128;
+    size_t *slots = calloc(count, sizeof(size_t));
+    size_t i;
+
+    if (slots == NULL)
+        return 0;
+    free(arena->change_slots);
+    arena->change_slots = slots;
+    arena->change_slot_count = count;
+    for (i = 0; i < arena->change_count; i++)
+        *change_slot(arena, arena->changes[i].type, arena->changes[i].start_address) = i + 1;
+    return 1;
+}
 
-        // Insert the new node at the end of the large allocation list
-        insert_node_at_end(&(arena->alloc_list->head), &(arena->alloc_list->tail), node_block);
+// Function to empty the set of logged entries. The latest goes first, which leaves the
+// others where probing from their hash still finds them.
+static void clear_change_slots(arena_t *arena)
+{
+    size_t i;
 
-        block_t *block = malloc(sizeof(block_t));
-        node_block->data = block;
-        block->start_address = address;
-        block->size = size;
+    for (i = arena->change_count; i > 0; i--)
+        *change_slot(arena, arena->changes[i - 1].type, arena->changes[i - 1].start_address) = 0;
+}
+
+// Function to note the state of the entry at an address before it changes, for the next diff.
+// Only the entry of the last map matters, so an address already logged is left as it is.
+static void log_change(arena_t *arena, const vma_record_type_t type, const uint64_t start,
+                       const uint64_t end, const uint8_t perm, const uint8_t existed)
+{
+    vma_change_t *changes = NULL;
+    size_t *slot = NULL;
+    size_t capacity = 0;
 
-        // Create a new list for miniblocks inside the block structure
-        list_t *mini_list = create_list();
-        block->miniblock_list = mini_list;
+    if (!arena->diff_tracking || arena->baseline != NULL)
+        return;
+    if (arena->change_count > 0 && *change_slot(arena, type, start) != 0)
+        return;
 
-        // Allocate memory for the first node in the miniblock list
-        node_t *node_miniblock = create_node();
+    if (arena->change_count == arena->change_capacity)
+    {
+        capacity = arena->change_capacity > 0 ? arena->change_capacity * 2 : 64;
+        changes = realloc(arena->changes, capacity * sizeof(vma_change_t));
+        if (changes == NULL)
+        {
+            // Without the log the next diff can only start over with the whole map
+            arena->diff_tracking = 0;
+            return;
+        }
+        arena->changes = changes;
+        arena->change_capacity = capacity;
+    }
+    if (2 * (arena->change_count + 1) > arena->change_slot_count && !grow_change_slots(arena))
+    {
+        arena->diff_tracking = 0;
+        return;
+    }
 
-        // Insert the new node at the end of the miniblock list
-        insert_node_at_end(&(mini_list->head), &(mini_list->tail), node_miniblock);
+    slot = change_slot(arena, type, start);
+    changes = &arena->changes[arena->change_count];
+    changes->type = type;
+    changes->start_address = start;
+    changes->end_address = end;
+    changes->perm = perm;
+    changes->existed = existed;
+    *slot = ++arena->change_count;
+}
 
-        // Allocate memory for the first miniblock associated with the node in the miniblock list
-        miniblock_t *miniblock = malloc(sizeof(miniblock_t));
+// Function to note the state of a block before it changes
+static void log_block(arena_t *arena, const block_t *block)
+{
+    log_change(arena, VMA_RECORD_BLOCK, block->start_address, block->start_address + block->size, 0, 1);
+}
 
-        // Connect the node in the miniblock list to the miniblock structure
-        node_miniblock->data = miniblock;
+// Function to note that nothing of the given type started at an address before a change
+static void log_absent(arena_t *arena, const vma_record_type_t type, const uint64_t address)
+{
+    log_change(arena, type, address, address, 0, 0);
+}
 
-        miniblock->start_address = address;
-        miniblock->size = size;
-        miniblock->perm = 6;
+// Function to order map entries by type and address
+static int compare_change(const void *a, const void *b)
+{
+    const vma_change_t *left = a;
+    const vma_change_t *right = b;
 
-        // Allocate memory for the read-write buffer inside the miniblock
-        miniblock->rw_buffer = malloc(size);
+    if (left->type != right->type)
+        return left->type < right->type ? -1 : 1;
+    return left->start_address < right->start_address ? -1 : left->start_address > right->start_address;
+}
 
-        // Update the size and data size of the miniblock list
-        mini_list->size++;
-        mini_list->data_size = mini_list->data_size + size;
+// Function to list every entry of the map, sorted like the change log
+static vma_change_t *map_entries(const arena_t *arena, size_t *count)
+{
+    vma_change_t *entries = malloc((arena->alloc_list->size + arena->miniblock_count + 1) * sizeof(vma_change_t));
+    vma_pmap_iter_t iter;
+    vma_record_t record;
 
-        // Check and merge with the right neighbor block if available
-        node_t *right_neighbour = check_have_right_neighbour(arena, address, size);
-        block_t *in_block_right = NULL;
-        list_t *mini_list_right = NULL;
+    *count = 0;
+    if (entries == NULL)
+        return NULL;
 
-        if (right_neighbour != NULL)
-        {
-            in_block_right = right_neighbour->data;
-            mini_list_right = in_block_right->miniblock_list;
-
-            // Update pointers to merge with the right neighbor block and its miniblock list
-            mini_list_right->head->prev = mini_list->tail;
-            mini_list->tail->next = mini_list_right->head;
-            mini_list->tail = mini_list_right->tail;
-            mini_list_right->tail = NULL;
-            mini_list_right->head = NULL;
-
-            // Update sizes and pointers after merging
-            mini_list->data_size += mini_list_right->data_size;
-            mini_list->size += mini_list_right->size;
-            arena->alloc_list->size--;
+    vma_pmap_begin(arena, &iter);
+    while (vma_pmap_next(&iter, &record))
+    {
+        entries[*count].type = record.type;
+        entries[*count].start_address = record.start_address;
+        entries[*count].end_address = record.end_address;
+        entries[*count].perm = record.perm;
+        entries[*count].existed = 1;
+        (*count)++;
+    }
+    qsort(entries, *count, sizeof(vma_change_t), compare_change);
+    return entries;
+}
 
-            // Update pointers in the allocation list after merging with the right neighbor block
-            right_neighbour->next->prev = right_neighbour->prev;
-            if (right_neighbour->prev != NULL)
-            {
-                right_neighbour->prev->next = right_neighbour->next;
-            }
-            else
-            {
-                arena->alloc_list->head = right_neighbour->next;
-            }
-            right_neighbour->next = NULL;
-            right_neighbour->prev = NULL;
+// Function to rebuild the last map from the current one and the change log, and keep it
+// instead of the log. Logged addresses hold what the last map had there, and every other
+// entry has not changed since.
+static void keep_baseline(arena_t *arena)
+{
+    vma_change_t *current = NULL;
+    vma_change_t *baseline = NULL;
+    size_t current_count = 0;
+    size_t count = 0;
+    size_t i = 0;
+    size_t j = 0;
+    int order = 0;
+
+    current = map_entries(arena, &current_count);
+    baseline = malloc((current_count + arena->change_count + 1) * sizeof(vma_change_t));
+    if (current == NULL || baseline == NULL)
+    {
+        free(current);
+        free(baseline);
+        arena->diff_tracking = 0; // The next diff starts over with the whole map, as above
+        return;
+    }
 
-            // Free memory occupied by the merged right neighbor miniblock list and block structure
-            free(mini_list_right);
-            free(in_block_right);
-            free(right_neighbour);
+    clear_change_slots(arena);
+    qsort(arena->changes, arena->change_count, sizeof(vma_change_t), compare_change);
+    while (i < current_count || j < arena->change_count)
+    {
+        order = i == current_count ? 1 : j == arena->change_count ? -1 : compare_change(&current[i], &arena->changes[j]);
+        if (order < 0)
+        {
+            baseline[count++] = current[i++];
+            continue;
         }
+        if (arena->changes[j].existed)
+            baseline[count++] = arena->changes[j];
+        i += order == 0;
+        j++;
+    }
+    free(current);
+    arena->change_count = 0;
+    arena->baseline = baseline;
+    arena->baseline_count = count;
+}
 
-        // Check and merge with the left neighbor block if available
-        node_t *left_neighbour = check_have_left_neighbour(arena, address);
-        block_t *in_block_left = NULL;
-        list_t *mini_list_left = NULL;
+// Function to keep the last map whole once the change log has grown past the size of the
+// map; called before the map changes, while it can still be walked
+static void bound_change_log(arena_t *arena)
+{
+    size_t limit = arena->alloc_list->size + arena->miniblock_count;
 
-        if (left_neighbour != NULL)
-        {
-            in_block_left = left_neighbour->data;
-            mini_list_left = in_block_left->miniblock_list;
-
-            // Update pointers to merge with the left neighbor block and its miniblock list
-            mini_list->head->prev = mini_list_left->tail;
-            mini_list_left->tail->next = mini_list->head;
-            mini_list_left->tail = mini_list->tail;
-            mini_list->head = NULL;
-            mini_list->tail = NULL;
-
-            // Update sizes and pointers after merging
-            mini_list_left->data_size += mini_list->data_size;
-            mini_list_left->size += mini_list->size;
-            arena->alloc_list->size--;
+    if (arena->diff_tracking && arena->baseline == NULL &&
+        arena->change_count >= (limit > DIFF_LOG_MIN ? limit : DIFF_LOG_MIN))
+        keep_baseline(arena);
+}
 
-            // Update pointers in the allocation list after merging with the left neighbor block
-            arena->alloc_list->tail = node_block->prev;
-            node_block->prev->next = NULL;
-            node_block->prev = NULL;
-
-            // Update block structure and miniblock list pointers after merging
-            block_t *temp = block;
-            block = in_block_left;
-            free(mini_list);
-            mini_list = mini_list_left;
-            free(temp);
-            free(node_block);
-        }
+// Function to get the treap priority of a miniblock, a hash of its index
+static uint32_t treap_priority(mb_index_t index)
+{
+    index ^= index >> 16;
+    index *= 0x7feb352d;
+    index ^= index >> 15;
+    index *= 0x846ca68b;
+    index ^= index >> 16;
+    return index;
+}
+
+// Function to recompute the subtree totals of a node from its children
+static void treap_update(const arena_t *arena, const mb_index_t node)
+{
+    miniblock_t *miniblock = get_miniblock(arena, node);
+    miniblock_t *child = NULL;
+    vma_packed_t count = 1;
+    vma_packed_t perm_and = MB_PERM(miniblock);
 
-        block->size = mini_list->data_size; // Update the block size after merging
+    miniblock->data_size = miniblock->size;
+    if (miniblock->left != 0)
+    {
+        child = get_miniblock(arena, miniblock->left);
+        count += MB_COUNT(child);
+        miniblock->data_size += child->data_size;
+        perm_and &= MB_PERM_AND(child);
+    }
+    if (miniblock->right != 0)
+    {
+        child = get_miniblock(arena, miniblock->right);
+        count += MB_COUNT(child);
+        miniblock->data_size += child->data_size;
+        perm_and &= MB_PERM_AND(child);
     }
+    miniblock->packed = count << 6 | perm_and << 3 | MB_PERM(miniblock);
 }
 
-// Function to find a miniblock using its address, return the miniblock and its parent block
-node_t *find_miniblock_using_address(arena_t *arena, const uint64_t address, node_t **return_block)
+// Function to join two treaps, every miniblock of left being before those of right
+static mb_index_t treap_merge(const arena_t *arena, const mb_index_t left, const mb_index_t right)
 {
-    block_t *block = NULL;
-    miniblock_t *miniblock = NULL;
-    node_t *node_list = arena->alloc_list->head;
-    node_t *node_mini_list = NULL;
-    list_t *mini_list = NULL;
-    (*return_block) = NULL;
+    if (left == 0)
+        return right;
+    if (right == 0)
+        return left;
 
-    // Iterate through the allocation list to find the miniblock with the given address
-    while (node_list != NULL)
+    // The node with the higher priority becomes the root of the joined treap
+    if (treap_priority(left) > treap_priority(right))
     {
-        block = node_list->data;
-        mini_list = block->miniblock_list;
-        node_mini_list = mini_list->head;
-
-        // Iterate through the miniblock list to find the miniblock with the given address
-        while (node_mini_list != NULL)
-        {
-            miniblock = node_mini_list->data;
-            if (miniblock->start_address == address)
-            {
-                *return_block = node_list;
-                return node_mini_list; // Return the node containing the found miniblock
-            }
-            node_mini_list = node_mini_list->next; // Move to the next node in the miniblock list
-        }
-        node_list = node_list->next; // Move to the next node in the allocation list
+        get_miniblock(arena, left)->right = treap_merge(arena, get_miniblock(arena, left)->right, right);
+        treap_update(arena, left);
+        return left;
     }
 
-    return NULL; // Miniblock with the given address not found, return NULL
+    get_miniblock(arena, right)->left = treap_merge(arena, left, get_miniblock(arena, right)->left);
+    treap_update(arena, right);
+    return right;
 }
 
-void free_block(arena_t *arena, const uint64_t address)
+// Function to split a treap into miniblocks starting before address and the rest
+static void treap_split(const arena_t *arena, const mb_index_t root, const uint64_t address,
+                        mb_index_t *left, mb_index_t *right)
 {
-    node_t *node = NULL;
-    node_t *mini_node = find_miniblock_using_address(arena, address, &node);
-    block_t *block = NULL;
     miniblock_t *miniblock = NULL;
-    list_t *mini_list = NULL;
-    node_t *new_node = NULL;
-    block_t *new_block = NULL;
-    list_t *new_mini_list = NULL;
-    uint64_t data_lost = 0;
-    uint64_t size_lost = 0;
-    node_t *aux = NULL;
 
-    // Check if the provided address is valid
-    if (mini_node == NULL)
+    if (root == 0)
+    {
+        *left = *right = 0;
+        return;
+    }
+
+    miniblock = get_miniblock(arena, root);
+    if (miniblock->start_address < address)
     {
-        printf("Invalid address for free.\n");
+        // The root and its left subtree stay on the left side
+        treap_split(arena, miniblock->right, address, &(miniblock->right), right);
+        *left = root;
     }
     else
     {
-        block = node->data;
-        mini_list = block->miniblock_list;
+        // The root and its right subtree go to the right side
+        treap_split(arena, miniblock->left, address, left, &(miniblock->left));
+        *right = root;
+    }
+    treap_update(arena, root);
+}
 
-        // If the miniblock list contains only one miniblock, delete the entire block from the allocation list
-        if (mini_list->size == 1)
-        {
-            arena->alloc_list->size--;
-            arena->alloc_list->data_size -= block->size;
-            delete_node_data(node, 1);
-            delete_node_from_list(arena->alloc_list, node);
-        }
-        else
-        {
-            if (mini_node == mini_list->head || mini_node == mini_list->tail)
-            {
-                miniblock = mini_node->data;
-                mini_list->size--;
-                mini_list->data_size = mini_list->data_size - miniblock->size;
-                block->size = mini_list->data_size;
-                arena->alloc_list->data_size -= miniblock->size;
-                if (mini_node == mini_list->head)
-                {
-                    miniblock = mini_node->next->data;
-                    block->start_address = miniblock->start_address;
-                    mini_list->head = mini_node->next;
-                }
-                else
-                {
-                    mini_list->tail = mini_node->prev;
-                }
-                delete_node_data(mini_node, 0);
-                delete_node_from_list(mini_list, mini_node);
-            }
+// Function to find the miniblock starting at the given address
+static mb_index_t treap_find(const arena_t *arena, mb_index_t root, const uint64_t address)
+{
+    miniblock_t *miniblock = NULL;
 
-            else // If the miniblock to be freed is in the middle of the miniblock list
-            {
-                arena->alloc_list->size++;
-
-                new_node = create_node();
-
-                // Insert the new node into the allocation list
-                // Update tail pointer if the new node is inserted at the end
-                if (node == arena->alloc_list->tail)
-                {
-                    arena->alloc_list->tail = new_node;
-                }
-                new_node->next = node->next;
-                new_node->prev = node;
-                node->next = new_node;
-
-                new_block = malloc(sizeof(block_t));
-                new_node->data = new_block;
-
-                if (mini_node->next != NULL)
-                    miniblock = mini_node->next->data;
-
-                new_block->start_address = miniblock->start_address;
-                new_mini_list = malloc(sizeof(list_t));
-                new_block->miniblock_list = new_mini_list;
-                new_mini_list->head = mini_node->next; 
-                new_mini_list->tail = mini_list->tail; 
-                mini_list->tail = mini_node->prev;
-                if (mini_node->next != NULL)
-                    mini_node->next->prev = NULL;
-                if (mini_node->prev != NULL)
-                    mini_node->prev->next = NULL; 
-
-                aux = new_mini_list->head;
-
-                while (aux != NULL)
-                {
-                    miniblock = aux->data;
-                    data_lost += miniblock->size;
-                    size_lost++;
-                    aux = aux->next;
-                }
-                new_mini_list->data_size = data_lost;
-                new_mini_list->size = size_lost;
-                miniblock = mini_node->data;
-                mini_list->data_size = mini_list->data_size - miniblock->size - new_mini_list->data_size;
-                mini_list->size = mini_list->size - size_lost - 1;
-                new_block->size = new_mini_list->data_size;
-                block->size -= new_mini_list->data_size + miniblock->size;
-                arena->alloc_list->data_size -= miniblock->size;
-
-                // Free memory occupied by the merged miniblock and node
-                free(miniblock->rw_buffer);
-                free(miniblock);
-                free(mini_node);
-            }
-        }
+    while (root != 0)
+    {
+        miniblock = get_miniblock(arena, root);
+        if (miniblock->start_address == address)
+            return root;
+        root = address < miniblock->start_address ? miniblock->left : miniblock->right;
     }
+    return 0; // No miniblock starts at the given address
 }
 
-// Function to check if the given address is allocated within the arena
-node_t *check_allocated(arena_t *arena, uint64_t address)
+// Function to find the miniblock containing the given address
+static mb_index_t treap_find_containing(const arena_t *arena, mb_index_t root, const uint64_t address)
 {
-    node_t *node = arena->alloc_list->head;
-    block_t *block = NULL;
+    miniblock_t *miniblock = NULL;
 
-    // Iterate through the blocks in the allocation list to check if the address is allocated
-    while (node != NULL)
+    while (root != 0)
     {
-        block = node->data;
-        if (block->start_address <= address && address < (block->start_address + block->size))
-        {
-            return node; // Return the node containing the allocated block
-        }
-        node = node->next; // Move to the next block in the allocation list
+        miniblock = get_miniblock(arena, root);
+        if (address < miniblock->start_address)
+            root = miniblock->left;
+        else if (address >= (uint64_t)miniblock->start_address + miniblock->size)
+            root = miniblock->right;
+        else
+            return root;
     }
-    return NULL; // Address not allocated, return NULL
+    return 0; // The address is not covered by any miniblock
 }
 
-// Function to read data from the allocated arena using the given address and size
-void read(arena_t *arena, uint64_t address, uint64_t size)
+// Function to find the first miniblock starting after the given address
+static mb_index_t treap_next(const arena_t *arena, mb_index_t root, const uint64_t address)
 {
-    node_t *node = NULL;
-    block_t *block = NULL;
-    list_t *mini_list = NULL;
-    node_t *mini_node = NULL;
+    mb_index_t next = 0;
     miniblock_t *miniblock = NULL;
-    uint64_t data_wrote_total = 0;
-    uint64_t data_in_miniblock = 0;
-    node = check_allocated(arena, address);
-    node_t *current = NULL;
-    int8_t perm_read = 1; // Variable to check read permissions
 
-    // If the address is allocated
-    if (node != NULL)
+    while (root != 0)
     {
-        block = node->data;
-        mini_list = block->miniblock_list;
-        mini_node = mini_list->head;
-
-        // Iterate through the miniblocks to check read permissions
-        current = mini_list->head;
-        while (current != NULL)
+        miniblock = get_miniblock(arena, root);
+        if (miniblock->start_address > address)
         {
-            miniblock = current->data;
-            if ((int)(miniblock->perm) < 4)
-            {
-                perm_read = 0; // Invalid permissions for read, set the flag to 0
-            }
-            current = current->next;
+            next = root; // Candidate, look for a closer one on the left
+            root = miniblock->left;
         }
-
-        // If read permissions are valid
-        if (perm_read)
+        else
         {
-            miniblock = mini_node->data;
-
-            // Find the miniblock containing the given address
-            while (!(miniblock->start_address <= address && address < (miniblock->start_address + miniblock->size)))
-            {
-                mini_node = mini_node->next;
-                miniblock = mini_node->data;
-            }
-            data_in_miniblock = miniblock->start_address + miniblock->size - address;
+            root = miniblock->right;
+        }
+    }
+    return next;
+}
 
-            // Warning if size is bigger than the block size
-            if (size > (block->size + block->start_address - address))
-            {
-                printf("Warning: size was bigger than the block size. Reading %ld characters.\n",
-                       block->size + block->start_address - address);
-            }
+// Function to change the permissions of a miniblock and refresh the totals on its path
+static int treap_set_perm(const arena_t *arena, const mb_index_t root, const uint64_t address,
+                          const uint8_t perm)
+{
+    miniblock_t *miniblock = NULL;
+    int found = 0;
 
-            // Read data from the miniblocks
-            while (size > data_wrote_total)
-            {
-                if (data_wrote_total == 0)
-                {
-                    if (size > data_in_miniblock)
-                    {
-                        fwrite(miniblock->rw_buffer + (miniblock->size - data_in_miniblock), 1, miniblock->size, stdout);
-                    }
-                    else
-                    {
-                        fwrite(miniblock->rw_buffer + (miniblock->size - data_in_miniblock), 1, size - data_wrote_total, stdout);
-                    }
-                }
-                else if (size - data_wrote_total <= miniblock->size)
-                {
-                    fwrite(miniblock->rw_buffer, 1, size - data_wrote_total, stdout);
-                }
-                else
-                {
-                    fwrite(miniblock->rw_buffer, 1, miniblock->size, stdout);
-                }
-                data_wrote_total += data_in_miniblock;
-                mini_node = mini_node->next;
+    if (root == 0)
+        return 0;
 
-                // Break if the end of the miniblock list is reached
-                if (mini_node == NULL)
-                {
-                    break;
-                }
-                miniblock = mini_node->data;
-                data_in_miniblock = miniblock->size;
-            }
-        }
-        else
-        {
-            printf("Invalid permissions for read.\n"); // Invalid permissions for read
-            return;
-        }
-        printf("\n");
+    miniblock = get_miniblock(arena, root);
+    if (miniblock->start_address == address)
+    {
+        miniblock->packed = (miniblock->packed & ~(vma_packed_t)7) | (perm & 7);
+        found = 1;
+    }
+    else if (address < miniblock->start_address)
+    {
+        found = treap_set_perm(arena, miniblock->left, address, perm);
     }
     else
     {
-        printf("Invalid address for read.\n"); // Invalid address for read
+        found = treap_set_perm(arena, miniblock->right, address, perm);
     }
+
+    if (found)
+        treap_update(arena, root);
+    return found;
 }
 
-// Function to write data into the allocated arena using the given address, size, and data
-void write(arena_t *arena, const uint64_t address, const uint64_t size, int8_t *data)
+// Function to delete a treap along with the buffers of its miniblocks and their pool entries.
+// The flat mapping is left alone, a file-backed arena keeps its contents.
+static void treap_delete(arena_t *arena, const mb_index_t root)
 {
-    node_t *node = NULL;
-    block_t *block = NULL;
-    list_t *mini_list = NULL;
-    node_t *mini_node = NULL;
     miniblock_t *miniblock = NULL;
-    uint64_t data_wrote_total = 0;
-    uint64_t data_in_miniblock = 0;
-    node = check_allocated(arena, address); // Check if the address is allocated in the arena
-    node_t *current = NULL;
-    int8_t perm_write = 1; // Variable to check write permissions
 
-    // If the address is allocated
-    if (node != NULL)
-    {
-        block = node->data;
-        mini_list = block->miniblock_list;
-        mini_node = mini_list->head;
+    if (root == 0)
+        return;
+
+    miniblock = get_miniblock(arena, root);
+    treap_delete(arena, miniblock->left);
+    treap_delete(arena, miniblock->right);
+#ifndef VMA_COMPACT
+    delete_buffer(arena, miniblock->rw_buffer); // NULL when the data lives in the flat mapping
+#endif
+    pool_release(arena, root);
+}
+
+// Function to set up an empty arena over the given data mapping (NULL for heap buffers)
+static arena_t *create_arena(const uint64_t size, uint8_t *flat, const int fd)
+{
+    // Allocate memory for the arena structure
+    arena_t *arena = malloc(sizeof(arena_t));
+    if (arena == NULL)
+        return NULL;
+
+    arena->arena_size = size;          // Set arena size
+    arena->alloc_list = create_list(); // Initialize allocation list using create_list() function
+    arena->miniblock_count = 0;
+    arena->chunks = NULL;
+    arena->chunk_count = 0;
+    arena->pool_next = 1; // Index 0 stands for no miniblock
+    arena->pool_free = 0;
+    arena->block_chunks = NULL;
+    arena->block_chunk_count = 0;
+    arena->block_next = 0;
+    arena->block_free = NULL;
+    arena->flat = flat;
+    arena->fd = fd;
+    arena->read_next = 0;
+    arena->heat = NULL;
+    arena->pages = NULL;
+    arena->diff_tracking = 0;
+    arena->changes = NULL;
+    arena->change_count = 0;
+    arena->change_capacity = 0;
+    arena->change_slots = NULL;
+    arena->change_slot_count = 0;
+    arena->baseline = NULL;
+    arena->baseline_count = 0;
+    arena->central = NULL;
+    return arena; // Return the newly created arena
+}
+
+// Function to allocate a new arena with the specified size
+arena_t *vma_alloc_arena(const uint64_t size)
+{
+    uint8_t *flat = NULL;
+    arena_t *arena = NULL;
+
+    // The compact layout stores addresses in 32 bits
+    if (size > VMA_MAX_ARENA_SIZE)
+        return NULL;
+
+#ifdef VMA_COMPACT
+    // Reserve the whole arena up front, pages are only backed once they are written
+    flat = mmap(NULL, size > 0 ? size : 1, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (flat == MAP_FAILED)
+        return NULL;
+#endif
+
+    arena = create_arena(size, flat, -1);
+    if (arena == NULL && flat != NULL)
+        munmap(flat, size > 0 ? size : 1);
+    return arena;
+}
+
+// Function to allocate an arena whose data lives in a sparse file mapped into memory,
+// so the arena can be larger than the memory of the host
+arena_t *vma_alloc_arena_file(const uint64_t size, const char *path)
+{
+    arena_t *arena = NULL;
+    uint8_t *flat = NULL;
+    int fd = -1;
+
+    if (size > VMA_MAX_ARENA_SIZE)
+        return NULL;
+
+    // Only the blocks that are written to take up space in the file
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        return NULL;
+    if (ftruncate(fd, size) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    flat = mmap(NULL, size > 0 ? size : 1, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if (flat == MAP_FAILED)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    arena = create_arena(size, flat, fd);
+    if (arena == NULL)
+    {
+        munmap(flat, size > 0 ? size : 1);
+        close(fd);
+    }
+    return arena;
+}
+
+// Function to write the dirty pages of a file-backed arena out to its file
+vma_status_t vma_flush(arena_t *arena)
+{
+    if (arena->fd < 0)
+        return VMA_OK; // Nothing to flush for anonymous memory
+    if (msync(arena->flat, arena->arena_size > 0 ? arena->arena_size : 1, MS_SYNC) != 0)
+        return VMA_ERR_IO;
+    return VMA_OK;
+}
+
+// Function to delete the block inside a node, along with its miniblock tree; the block itself
+// goes back to the pool with its node
+static void delete_node_data(arena_t *arena, node_t *node)
+{
+    block_t *block = node->data;                // Set the block pointer to the data inside the node
+    treap_delete(arena, block->miniblock_tree); // Delete every miniblock of the block
+}
 
-        // Iterate through the miniblocks to check write permissions
-        current = mini_list->head;
-        while (current != NULL)
+#ifndef VMA_COMPACT
+// Function to free the heap buffers of the miniblocks of a treap, leaving their pool entries
+// to go with the whole pool
+static void treap_free_buffers(arena_t *arena, const mb_index_t root)
+{
+    miniblock_t *miniblock = NULL;
+
+    if (root == 0)
+        return;
+
+    miniblock = get_miniblock(arena, root);
+    treap_free_buffers(arena, miniblock->left);
+    treap_free_buffers(arena, miniblock->right);
+    delete_buffer(arena, miniblock->rw_buffer);
+}
+#endif
+
+// Function to delete a node from a list, giving it back to the pool
+static void delete_node_from_list(arena_t *arena, list_t *list, node_t *node)
+{
+    // Update pointers in the adjacent nodes to bypass the node to be deleted
+    if (node == list->head)
+    {
+        list->head = node->next; // Update the head of the list
+    }
+    if (node == list->tail)
+    {
+        list->tail = node->prev; // Update the tail of the list
+    }
+    if (node->prev != NULL)
+    {
+        node->prev->next = node->next; // Update next pointer of the previous node
+    }
+    if (node->next != NULL)
+    {
+        node->next->prev = node->prev; // Update prev pointer of the next node
+    }
+    block_release(arena, node); // The block inside goes with it
+}
+
+// Function to deallocate memory occupied by an arena and its associated data structures.
+// Blocks and miniblocks are not released one by one, their pools are freed whole.
+void vma_dealloc_arena(arena_t *arena)
+{
+    size_t i;
+#ifndef VMA_COMPACT
+    node_t *node = NULL;
+#endif
+
+    // The objects of the size classes are miniblocks too, they need not be freed first
+    if (arena->central != NULL)
+    {
+        arena->central->arena = NULL;
+        vma_central_destroy(arena->central);
+    }
+
+#ifndef VMA_COMPACT
+    // Only data kept on the heap has to be found block by block
+    if (arena->flat == NULL)
+        for (node = arena->alloc_list->head; node != NULL; node = node->next)
+            treap_free_buffers(arena, ((block_t *)node->data)->miniblock_tree);
+#endif
+    free(arena->alloc_list);
+    if (arena->pages != NULL)
+        delete_page_store(arena->pages);
+
+    // Release the pools and the data mapping
+    for (i = 0; i < arena->chunk_count; i++)
+        free(arena->chunks[i]);
+    free(arena->chunks);
+    for (i = 0; i < arena->block_chunk_count; i++)
+        free(arena->block_chunks[i]);
+    free(arena->block_chunks);
+    if (arena->flat != NULL)
+        munmap(arena->flat, arena->arena_size > 0 ? arena->arena_size : 1);
+    if (arena->fd >= 0)
+        close(arena->fd);
+    vma_heat_config(arena, 0, 0);
+    free(arena->changes);
+    free(arena->change_slots);
+    free(arena->baseline);
+    free(arena);
+}
+
+// Function to find the first block starting after the given address (NULL if there is none)
+static node_t *find_block_after(const arena_t *arena, const uint64_t address)
+{
+    node_t *node_block = arena->alloc_list->head;
+    block_t *in_block;
+
+    // The blocks are sorted, so stop at the first one past the address
+    while (node_block != NULL)
+    {
+        in_block = node_block->data;
+        if (in_block->start_address > address)
+            break;
+        node_block = node_block->next;
+    }
+    return node_block;
+}
+
+// Function to check if the given address is allocated within the arena
+static node_t *check_allocated(const arena_t *arena, const uint64_t address)
+{
+    node_t *next = find_block_after(arena, address);
+    node_t *node = next != NULL ? next->prev : arena->alloc_list->tail;
+    block_t *block = NULL;
+
+    // Only the last block starting at or before the address can contain it
+    if (node != NULL)
+    {
+        block = node->data;
+        if (address < block->start_address + block->size)
+            return node; // Return the node containing the allocated block
+    }
+    return NULL; // Address not allocated, return NULL
+}
+
+// Function to allocate a block in the arena with the given address and size
+vma_status_t vma_alloc_block(arena_t *arena, const uint64_t address, const uint64_t size)
+{
+    node_t *right_neighbour = find_block_after(arena, address);
+    node_t *left_neighbour = right_neighbour != NULL ? right_neighbour->prev : arena->alloc_list->tail;
+    block_t *left_block = left_neighbour != NULL ? left_neighbour->data : NULL;
+    block_t *right_block = right_neighbour != NULL ? right_neighbour->data : NULL;
+    node_t *node_block = NULL;
+
+    // Error checking for invalid allocation addresses and overlapping allocations
+    if (address >= arena->arena_size)
+        return VMA_ERR_ADDRESS_OUTSIDE;
+    if (address + size > arena->arena_size)
+        return VMA_ERR_END_OUTSIDE;
+    if ((left_block != NULL && left_block->start_address + left_block->size > address) ||
+        (right_block != NULL && right_block->start_address < address + size))
+        return VMA_ERR_ALREADY_ALLOCATED;
+
+    // Only blocks touching the new one are merged with it
+    if (left_block != NULL && left_block->start_address + left_block->size != address)
+        left_block = NULL;
+    if (right_block != NULL && right_block->start_address != address + size)
+        right_block = NULL;
+
+    // The packed subtree count and the pool index bound the number of miniblocks
+    if (arena->miniblock_count >= VMA_MAX_MINIBLOCKS)
+        return VMA_ERR_MINIBLOCK_LIMIT;
+    bound_change_log(arena);
+
+    // Without neighbours the miniblock needs a block of its own, taken before anything changes
+    if (left_block == NULL && right_block == NULL)
+    {
+        node_block = block_alloc(arena);
+        if (node_block == NULL)
+            return VMA_ERR_NO_MEMORY;
+    }
+
+    // Take a miniblock from the pool and give it its read-write buffer
+    mb_index_t mini_tree = pool_alloc(arena);
+    if (mini_tree == 0)
+    {
+        if (node_block != NULL)
+            block_release(arena, node_block);
+        return VMA_ERR_NO_MEMORY;
+    }
+    miniblock_t *miniblock = get_miniblock(arena, mini_tree);
+    miniblock->start_address = address;
+    miniblock->size = size;
+    miniblock->left = miniblock->right = 0;
+    miniblock->packed = VMA_PROT_READ | VMA_PROT_WRITE;
+#ifndef VMA_COMPACT
+    miniblock->rw_buffer = arena->flat == NULL ? create_buffer(arena, size) : NULL;
+    if (arena->flat == NULL && miniblock->rw_buffer == NULL && size > 0)
+    {
+        pool_release(arena, mini_tree);
+        if (node_block != NULL)
+            block_release(arena, node_block);
+        return VMA_ERR_NO_MEMORY;
+    }
+#endif
+    treap_update(arena, mini_tree);
+
+    // A reused pool entry must not inherit the heat of the miniblock it held before
+    if (arena->heat != NULL && mini_tree < arena->heat->miniblock_capacity)
+        memset(&arena->heat->miniblocks[mini_tree], 0, sizeof(vma_heat_counter_t));
+
+    // Update the data size of the large allocation list
+    arena->alloc_list->data_size += size;
+    arena->miniblock_count++;
+    log_absent(arena, VMA_RECORD_MINIBLOCK, address);
+
+    if (left_block != NULL)
+    {
+        log_block(arena, left_block);
+        // Join our miniblock tree after the left neighbour's, and the right one's after that
+        left_block->miniblock_tree = treap_merge(arena, left_block->miniblock_tree, mini_tree);
+        if (right_block != NULL)
         {
-            miniblock = current->data;
-            // Check if write permissions are valid
-            if ((int)(miniblock->perm) != 2 && (int)(miniblock->perm) != 6 &&
-                (int)(miniblock->perm) != 3 && (int)(miniblock->perm) != 7)
-            {
-                perm_write = 0;
-            }
-            current = current->next;
+            log_block(arena, right_block);
+            left_block->miniblock_tree = treap_merge(arena, left_block->miniblock_tree,
+                                                     right_block->miniblock_tree);
+            delete_node_from_list(arena, arena->alloc_list, right_neighbour);
+            arena->alloc_list->size--;
         }
+        left_block->size = get_miniblock(arena, left_block->miniblock_tree)->data_size; // Update the block size after merging
+    }
+    else if (right_block != NULL)
+    {
+        // The right neighbour now starts with our miniblock
+        log_block(arena, right_block);
+        log_absent(arena, VMA_RECORD_BLOCK, address);
+        right_block->start_address = address;
+        right_block->miniblock_tree = treap_merge(arena, mini_tree, right_block->miniblock_tree);
+        right_block->size = get_miniblock(arena, right_block->miniblock_tree)->data_size;
+    }
+    else
+    {
+        // No neighbours, the miniblock gets a block of its own, keeping the list sorted
+        log_absent(arena, VMA_RECORD_BLOCK, address);
+        block_t *block = node_block->data;
+        block->start_address = address;
+        block->miniblock_tree = mini_tree;
+        block->size = size;
 
-        // If write permissions are valid
-        if (perm_write)
-        {
-            miniblock = mini_node->data;
+        insert_node_before(arena->alloc_list, right_neighbour, node_block);
+        arena->alloc_list->size++;
+    }
+    return VMA_OK;
+}
 
-            // Find the miniblock containing the given address
-            while (!(miniblock->start_address <= address &&
-                     address < (miniblock->start_address + miniblock->size)))
-            {
-                mini_node = mini_node->next;
-                miniblock = mini_node->data;
-            }
-            data_in_miniblock = miniblock->start_address + miniblock->size - address;
+// Function to find a miniblock using its address, return the miniblock and its parent block
+static mb_index_t find_miniblock_using_address(const arena_t *arena, const uint64_t address,
+                                               node_t **return_block)
+{
+    block_t *block = NULL;
+    mb_index_t mini_node = 0;
 
-            // Write data into the miniblocks
-            if (size <= data_in_miniblock)
-            {
-                memcpy(miniblock->rw_buffer, data, size);
-            }
-            else
-            {
-                while (size > data_wrote_total)
-                {
-                    if (data_wrote_total == 0)
-                    {
-                        memcpy(miniblock->rw_buffer +
-                                   (miniblock->size - data_in_miniblock),
-                               data, data_in_miniblock);
-                    }
-                    else if (size - data_wrote_total <= miniblock->size)
-                    {
-                        memcpy(miniblock->rw_buffer, data + data_wrote_total,
-                               size - data_wrote_total);
-                    }
-                    else
-                    {
-                        memcpy(miniblock->rw_buffer, data + data_wrote_total,
-                               miniblock->size);
-                    }
-                    data_wrote_total += data_in_miniblock;
-                    mini_node = mini_node->next;
-                    if (mini_node == NULL)
-                    {
-                        break;
-                    }
-                    miniblock = mini_node->data;
-                    data_in_miniblock = miniblock->size;
-                }
-                if (size > data_wrote_total)
-                {
-                    printf(
-                        "Warning: size was bigger than the block size. Writing %ld "
-                        "characters.\n",
-                        data_wrote_total);
-                }
-            }
-        }
-        else
+    // Find the block covering the address, then look the miniblock up in its tree
+    (*return_block) = check_allocated(arena, address);
+    if ((*return_block) == NULL)
+        return 0;
+
+    block = (*return_block)->data;
+    mini_node = treap_find(arena, block->miniblock_tree, address);
+    if (mini_node == 0)
+        (*return_block) = NULL;
+
+    return mini_node; // 0 if no miniblock starts at the given address
+}
+
+// Function to free the miniblock starting at the given address, splitting its block if needed
+vma_status_t vma_free_block(arena_t *arena, const uint64_t address)
+{
+    node_t *node = NULL;
+    mb_index_t mini_node = find_miniblock_using_address(arena, address, &node);
+    block_t *block = NULL;
+    miniblock_t *miniblock = NULL;
+    mb_index_t left_tree = 0;
+    mb_index_t right_tree = 0;
+    node_t *new_node = NULL;
+    block_t *new_block = NULL;
+    uint64_t freed_size = 0;
+
+    // Check if the provided address is valid
+    if (mini_node == 0)
+        return VMA_ERR_INVALID_ADDRESS;
+
+    block = node->data;
+    miniblock = get_miniblock(arena, mini_node);
+    freed_size = miniblock->size;
+    bound_change_log(arena);
+
+    // Freeing a miniblock in the middle splits the block, so the new block is taken first
+    if (address > block->start_address && address + freed_size < block->start_address + block->size)
+    {
+        new_node = block_alloc(arena);
+        if (new_node == NULL)
+            return VMA_ERR_NO_MEMORY;
+    }
+    log_change(arena, VMA_RECORD_MINIBLOCK, address, address + freed_size, MB_PERM(miniblock), 1);
+    log_block(arena, block);
+    arena->alloc_list->data_size -= freed_size;
+    arena->miniblock_count--;
+
+    // Cut the miniblock out of the tree, keeping the ones before and after it apart
+    treap_split(arena, block->miniblock_tree, address, &left_tree, &right_tree);
+    treap_split(arena, right_tree, address + 1, &mini_node, &right_tree);
+    release_data(arena, miniblock);
+    pool_release(arena, mini_node);
+
+    if (left_tree == 0 && right_tree == 0)
+    {
+        // It was the only miniblock, delete the entire block from the allocation list
+        arena->alloc_list->size--;
+        block->miniblock_tree = 0;
+        delete_node_data(arena, node);
+        delete_node_from_list(arena, arena->alloc_list, node);
+    }
+    else if (left_tree == 0 || right_tree == 0)
+    {
+        // The miniblock was at the head or the tail of the block
+        block->miniblock_tree = left_tree != 0 ? left_tree : right_tree;
+        if (left_tree == 0)
         {
-            printf("Invalid permissions for write.\n"); // Invalid permissions for write
+            block->start_address = address + freed_size;
+            log_absent(arena, VMA_RECORD_BLOCK, block->start_address);
         }
+        block->size = get_miniblock(arena, block->miniblock_tree)->data_size;
     }
     else
     {
-        printf("Invalid address for write.\n"); // Invalid address for write
+        // The miniblock was in the middle, the right part becomes a new block after this one
+        block->miniblock_tree = left_tree;
+        block->size = get_miniblock(arena, left_tree)->data_size;
+
+        new_block = new_node->data;
+        new_block->start_address = address + freed_size;
+        log_absent(arena, VMA_RECORD_BLOCK, new_block->start_address);
+        new_block->miniblock_tree = right_tree;
+        new_block->size = get_miniblock(arena, right_tree)->data_size;
+
+        insert_node_before(arena->alloc_list, node->next, new_node);
+        arena->alloc_list->size++;
     }
-    free(data); // Free the allocated data buffer
+    return VMA_OK;
 }
 
-// Function to display the permissions of a miniblock (Read, Write, Execute)
-void show_perm(miniblock_t *miniblock)
+// Function to get the size of the miniblock starting at the given address
+vma_status_t vma_miniblock_size(const arena_t *arena, const uint64_t address, uint64_t *size)
 {
-    if ((miniblock->perm >> 2) & 1)
-        printf("R"); // Read permission
-    else
-        printf("-");
+    node_t *node = NULL;
+    mb_index_t mini_node = find_miniblock_using_address(arena, address, &node);
 
-    if ((miniblock->perm >> 1) & 1)
-        printf("W"); // Write permission
-    else
-        printf("-");
+    if (mini_node == 0)
+        return VMA_ERR_INVALID_ADDRESS;
+    *size = get_miniblock(arena, mini_node)->size;
+    return VMA_OK;
+}
 
-    if (miniblock->perm & 1)
-        printf("X"); // Execute permission
-    else
-        printf("-");
+// Function to get how many bytes of its block follow the given address
+vma_status_t vma_block_remaining(const arena_t *arena, const uint64_t address, uint64_t *remaining)
+{
+    node_t *node = check_allocated(arena, address);
+    block_t *block = NULL;
+
+    if (node == NULL)
+        return VMA_ERR_INVALID_ADDRESS;
+    block = node->data;
+    *remaining = block->start_address + block->size - address;
+    return VMA_OK;
 }
 
-// Function to print the memory map (block addresses, miniblock addresses, permissions)
-void pmap(const arena_t *arena)
+// Function to allocate size bytes in the first free zone they fit in, at a multiple of align
+vma_status_t vma_malloc(arena_t *arena, const uint64_t size, const uint64_t align, uint64_t *address)
 {
-    printf("Total memory: 0x%lX bytes\n", arena->arena_size);
-    printf("Free memory: 0x%lX bytes\n",
-           arena->arena_size - arena->alloc_list->data_size);
-    printf("Number of allocated blocks: %ld\n", arena->alloc_list->size);
     node_t *node = arena->alloc_list->head;
-    uint64_t miniblocks_no = 0;
     block_t *block = NULL;
-    list_t *list = NULL;
+    uint64_t start = 0;
 
-    // Iterate through the allocated blocks to count the total number of allocated miniblocks
-    while (node != NULL)
+    // Try the zone before each block, then the one after the last block
+    for (;;)
     {
-        block = node->data;
-        list = block->miniblock_list;
-        miniblocks_no += list->size;
+        if (align > 1)
+            start = (start + align - 1) / align * align;
+        block = node != NULL ? node->data : NULL;
+        if (block == NULL || (start <= block->start_address && block->start_address - start >= size))
+            break;
+        start = block->start_address + block->size;
         node = node->next;
     }
-    printf("Number of allocated miniblocks: %ld\n", miniblocks_no); // Print number of allocated miniblocks
 
-    size_t i, j, k;
-    node = arena->alloc_list->head;
-    node_t *mini_node = NULL;
+    if (start >= arena->arena_size || size > arena->arena_size - start)
+        return VMA_ERR_ARENA_FULL;
+    *address = start;
+    return vma_alloc_block(arena, start, size);
+}
+
+// Function to find the block covering [address, address + size) and how much of it is there
+static node_t *find_access_block(const arena_t *arena, const uint64_t address,
+                                 const uint64_t size, uint64_t *available)
+{
+    node_t *node = check_allocated(arena, address);
+    block_t *block = NULL;
+
+    if (node == NULL)
+        return NULL;
+
+    block = node->data;
+    *available = block->start_address + block->size - address;
+    if (*available > size)
+        *available = size;
+    return node;
+}
+
+// Function to read data from the allocated arena into buffer, stopping at the end of the block
+vma_status_t vma_read(arena_t *arena, const uint64_t address, const uint64_t size,
+                      void *buffer, uint64_t *done)
+{
+    uint64_t available = 0;
+    uint64_t offset = 0;
+    uint64_t chunk = 0;
+    node_t *node = find_access_block(arena, address, size, &available);
+    block_t *block = NULL;
+    mb_index_t mini_node = 0;
     miniblock_t *miniblock = NULL;
-    node_t *curr_node = NULL;
-    int64_t min_address = 92233720307;
-    int64_t min_last = -1;
+    int sampled = 0;
+
+    *done = 0;
+    if (node == NULL)
+        return VMA_ERR_INVALID_ADDRESS; // Invalid address for read
 
-    // Iterate through the allocated blocks and their miniblocks to print the memory map
-    for (i = 1; i <= arena->alloc_list->size; i++)
+    // Every miniblock of the block needs read permissions, the root keeps their AND
+    block = node->data;
+    if (!(MB_PERM_AND(get_miniblock(arena, block->miniblock_tree)) & VMA_PROT_READ))
+        return VMA_ERR_PERMISSION;
+
+    advise_read(arena, address, available);
+
+    // Copy from the miniblock containing the address, then from the ones after it
+    sampled = heat_sample(arena);
+    mini_node = treap_find_containing(arena, block->miniblock_tree, address);
+    offset = address - get_miniblock(arena, mini_node)->start_address;
+    while (*done < available)
     {
-        curr_node = arena->alloc_list->head;
-        min_address = 92233720307;
-        for (k = 1; k <= arena->alloc_list->size; k++)
-        {
-            block = curr_node->data;
-            if ((int64_t)block->start_address < min_address && (int64_t)block->start_address > min_last)
-            {
-                node = curr_node;
-                min_address = block->start_address;
-            }
-            curr_node = curr_node->next;
-        }
-        block = node->data;
-        printf("\nBlock %ld begin\n", i);
-        printf("Zone: 0x%lX - 0x%lX\n", block->start_address,
-               block->start_address + block->size);
+        miniblock = get_miniblock(arena, mini_node);
+        chunk = miniblock->size - offset;
+        if (chunk > available - *done)
+            chunk = available - *done;
+        if (!copy_out(arena, miniblock, offset, (char *)buffer + *done, chunk))
+            return VMA_ERR_NO_MEMORY;
+        if (sampled)
+            heat_record(arena, mini_node, address + *done, chunk, 0);
+        *done += chunk;
+        offset = 0;
+        mini_node = treap_next(arena, block->miniblock_tree, miniblock->start_address);
+    }
+
+    // Pages this access left raw may push colder ones out of the hot set
+    if (arena->pages != NULL)
+        page_store_trim(arena->pages);
+    return VMA_OK;
+}
+
+// Function to write data into the allocated arena, stopping at the end of the block
+vma_status_t vma_write(arena_t *arena, const uint64_t address, const uint64_t size,
+                       const void *data, uint64_t *done)
+{
+    uint64_t available = 0;
+    uint64_t offset = 0;
+    uint64_t chunk = 0;
+    node_t *node = find_access_block(arena, address, size, &available);
+    block_t *block = NULL;
+    mb_index_t mini_node = 0;
+    miniblock_t *miniblock = NULL;
+    int sampled = 0;
+
+    *done = 0;
+    if (node == NULL)
+        return VMA_ERR_INVALID_ADDRESS; // Invalid address for write
+
+    // Every miniblock of the block needs write permissions, the root keeps their AND
+    block = node->data;
+    if (!(MB_PERM_AND(get_miniblock(arena, block->miniblock_tree)) & VMA_PROT_WRITE))
+        return VMA_ERR_PERMISSION;
+
+    // Copy into the miniblock containing the address, then into the ones after it
+    sampled = heat_sample(arena);
+    mini_node = treap_find_containing(arena, block->miniblock_tree, address);
+    offset = address - get_miniblock(arena, mini_node)->start_address;
+    while (*done < available)
+    {
+        miniblock = get_miniblock(arena, mini_node);
+        chunk = miniblock->size - offset;
+        if (chunk > available - *done)
+            chunk = available - *done;
+        if (!copy_in(arena, miniblock, offset, (const char *)data + *done, chunk))
+            return VMA_ERR_NO_MEMORY;
+        if (sampled)
+            heat_record(arena, mini_node, address + *done, chunk, 1);
+        *done += chunk;
+        offset = 0;
+        mini_node = treap_next(arena, block->miniblock_tree, miniblock->start_address);
+    }
+
+    // Pages this access left raw may push colder ones out of the hot set
+    if (arena->pages != NULL)
+        page_store_trim(arena->pages);
+    return VMA_OK;
+}
+
+// Function to set memory protection permissions for a specific address in the arena
+vma_status_t vma_mprotect(arena_t *arena, const uint64_t address, const uint8_t perm)
+{
+    node_t *node = NULL;
+    mb_index_t mini_node = find_miniblock_using_address(arena, address, &node);
+    miniblock_t *miniblock = NULL;
+    block_t *block = NULL;
+
+    // The address must be the start of a miniblock of the block covering it
+    if (mini_node == 0)
+        return VMA_ERR_INVALID_ADDRESS;
+
+    block = node->data;
+    miniblock = get_miniblock(arena, mini_node);
+    bound_change_log(arena);
+    log_change(arena, VMA_RECORD_MINIBLOCK, address, address + miniblock->size, MB_PERM(miniblock), 1);
+    treap_set_perm(arena, block->miniblock_tree, address, perm);
+    return VMA_OK;
+}
+
+// Function to turn the access heat map on (resetting its counters) or off
+vma_status_t vma_heat_config(arena_t *arena, const uint32_t sample_rate, const size_t bucket_count)
+{
+    vma_heat_t *heat = NULL;
+
+    if (arena->heat != NULL)
+    {
+        free(arena->heat->buckets);
+        free(arena->heat->miniblocks);
+        free(arena->heat);
+        arena->heat = NULL;
+    }
+    if (sample_rate == 0)
+        return VMA_OK;
+
+    heat = malloc(sizeof(vma_heat_t));
+    if (heat == NULL)
+        return VMA_ERR_NO_MEMORY;
+    heat->sample_rate = sample_rate;
+    heat->tick = 0;
+    heat->bucket_count = bucket_count > 0 ? bucket_count : 1;
+    if (heat->bucket_count > arena->arena_size && arena->arena_size > 0)
+        heat->bucket_count = arena->arena_size; // Buckets of at least one byte
+
+    // Round the bucket size up, so the buckets cover the whole arena
+    heat->bucket_size = (arena->arena_size + heat->bucket_count - 1) / heat->bucket_count;
+    if (heat->bucket_size == 0)
+        heat->bucket_size = 1;
+    heat->buckets = calloc(heat->bucket_count, sizeof(vma_heat_counter_t));
+    heat->miniblocks = NULL;
+    heat->miniblock_capacity = 0;
+    if (heat->buckets == NULL)
+    {
+        free(heat);
+        return VMA_ERR_NO_MEMORY;
+    }
+    arena->heat = heat;
+    return VMA_OK;
+}
+
+#ifndef VMA_COMPACT
+// Function to copy the plain buffers of a treap's miniblocks into page tables of store,
+// appended to tables in preorder; the miniblocks keep their buffers until every copy is made
+static int build_tables(const arena_t *arena, vma_page_store_t *store, const mb_index_t root,
+                        vma_page_table_t **tables, size_t *count)
+{
+    const miniblock_t *miniblock = NULL;
+    vma_page_table_t *table = NULL;
+
+    if (root == 0)
+        return 1;
+
+    miniblock = get_miniblock(arena, root);
+    table = create_page_table(store, miniblock->size);
+    if (table == NULL)
+        return 0;
+    if (!page_table_write(store, table, 0, miniblock->rw_buffer, miniblock->size))
+    {
+        delete_page_table(store, table);
+        return 0;
+    }
+    tables[(*count)++] = table;
+    page_store_trim(store); // Pack as we go, so the copies take as little memory as they can
+    return build_tables(arena, store, miniblock->left, tables, count) &&
+           build_tables(arena, store, miniblock->right, tables, count);
+}
 
-        list = block->miniblock_list;
-        mini_node = list->head;
-        for (j = 1; j <= list->size; j++)
+// Function to swap the plain buffers of a treap's miniblocks for the tables built for them
+static void install_tables(arena_t *arena, const mb_index_t root, vma_page_table_t **tables, size_t *count)
+{
+    miniblock_t *miniblock = NULL;
+
+    if (root == 0)
+        return;
+
+    miniblock = get_miniblock(arena, root);
+    free(miniblock->rw_buffer);
+    miniblock->rw_buffer = tables[(*count)++];
+    install_tables(arena, miniblock->left, tables, count);
+    install_tables(arena, miniblock->right, tables, count);
+}
+#endif
+
+// Function to switch an arena to paged storage, or change the hot limit if it already uses it.
+// The store is only published once every miniblock has a table, so a failure changes nothing.
+vma_status_t vma_paging_config(arena_t *arena, const uint64_t hot_limit)
+{
+#ifdef VMA_COMPACT
+    (void)hot_limit;
+    (void)arena;
+    return VMA_ERR_UNSUPPORTED; // The data lives in the flat mapping
+#else
+    vma_page_store_t *store = NULL;
+    vma_page_table_t **tables = NULL;
+    node_t *node = NULL;
+    size_t count = 0;
+    int built = 1;
+
+    // A mapping already leaves untouched pages to the kernel
+    if (arena->flat != NULL)
+        return VMA_ERR_UNSUPPORTED;
+
+    if (arena->pages == NULL)
+    {
+        store = create_page_store(hot_limit);
+        tables = malloc((arena->miniblock_count > 0 ? arena->miniblock_count : 1) * sizeof(vma_page_table_t *));
+        for (node = arena->alloc_list->head; store != NULL && tables != NULL && built && node != NULL;
+             node = node->next)
+            built = build_tables(arena, store, ((block_t *)node->data)->miniblock_tree, tables, &count);
+        if (store == NULL || tables == NULL || !built)
         {
-            miniblock = mini_node->data;
-            printf("Miniblock %ld:\t\t0x%lX\t\t-\t\t0x%lX\t\t| ", j,
-                   miniblock->start_address,
-                   miniblock->start_address + miniblock->size);
-            show_perm(miniblock); // Print permissions of the miniblock
-            printf("\n");
-            mini_node = mini_node->next;
+            while (count > 0)
+                delete_page_table(store, tables[--count]);
+            if (store != NULL)
+                delete_page_store(store);
+            free(tables);
+            return VMA_ERR_NO_MEMORY;
         }
 
-        printf("Block %ld end", i);
-        printf("\n");
-        node = node->next;
-        min_last = min_address;
+        count = 0;
+        for (node = arena->alloc_list->head; node != NULL; node = node->next)
+            install_tables(arena, ((block_t *)node->data)->miniblock_tree, tables, &count);
+        free(tables);
+        arena->pages = store;
     }
+    arena->pages->hot_limit = hot_limit;
+    page_store_trim(arena->pages);
+    return VMA_OK;
+#endif
 }
 
-// Function to parse the input string and convert permission string to integer representation
-int8_t mprotect_aux(char *string)
+// Function to cap the memory holding an arena's data, switching it to paged storage first
+vma_status_t vma_swap_config(arena_t *arena, const uint64_t resident_limit)
 {
-    int8_t result = 0;
-    char *p = strtok(string, "\n |"); // Tokenize the input string using space and newline characters
+    vma_status_t status = VMA_OK;
 
-    // Iterate through the tokens and convert permission strings to integer representation
-    while (p)
+    // Pages stay raw up to the cap unless a hot limit was already chosen
+    if (arena->pages == NULL)
     {
-        // Check each token and update the result based on the permission string
-        if (strcmp(p, "PROT_NONE") == 0)
-            result += 0;
-        if (strcmp(p, "PROT_READ") == 0)
-            result += 4;
-        if (strcmp(p, "PROT_WRITE") == 0)
-            result += 2;
-        if (strcmp(p, "PROT_EXEC") == 0)
-            result += 1;
-
-        p = strtok(NULL, "\n |"); // Move to the next token
+        status = vma_paging_config(arena, resident_limit);
+        if (status != VMA_OK)
+            return status;
     }
-    return result; // Return the integer representation of the permissions
+    if (!page_store_swap_config(arena->pages, resident_limit))
+        return VMA_ERR_IO;
+    return VMA_OK;
 }
 
-// Function to set memory protection permissions for a specific address in the arena
-void mprotect(arena_t *arena, uint64_t address, int8_t *permission)
+#ifndef VMA_COMPACT
+// Function to deduplicate the pages of a treap's miniblocks
+static void treap_dedup(arena_t *arena, const mb_index_t root)
 {
-    uint64_t valid_address = 0;
-    miniblock_t *minichosen_block = NULL;
     miniblock_t *miniblock = NULL;
-    list_t *mini_list = NULL;
-    node_t *mini_node = NULL;
+
+    if (root == 0)
+        return;
+    miniblock = get_miniblock(arena, root);
+    page_table_dedup(arena->pages, miniblock->rw_buffer);
+    treap_dedup(arena, miniblock->left);
+    treap_dedup(arena, miniblock->right);
+}
+#endif
+
+// Function to share identical pages across every miniblock of an arena
+vma_status_t vma_dedup(arena_t *arena)
+{
+#ifdef VMA_COMPACT
+    (void)arena;
+    return VMA_ERR_UNSUPPORTED; // Only paged storage keeps pages apart
+#else
+    node_t *node = NULL;
+
+    if (arena->pages == NULL)
+        return VMA_ERR_UNSUPPORTED;
+    if (!page_store_dedup_begin(arena->pages))
+        return VMA_ERR_NO_MEMORY;
+    for (node = arena->alloc_list->head; node != NULL; node = node->next)
+        treap_dedup(arena, ((block_t *)node->data)->miniblock_tree);
+    page_store_dedup_end(arena->pages);
+    return VMA_OK;
+#endif
+}
+
+#ifndef VMA_COMPACT
+// Function to add up the bytes of memory holding the data of a treap's miniblocks
+static uint64_t treap_stored(const arena_t *arena, const mb_index_t root)
+{
+    const miniblock_t *miniblock = NULL;
+
+    if (root == 0)
+        return 0;
+    miniblock = get_miniblock(arena, root);
+    return page_table_stored(miniblock->rw_buffer) + treap_stored(arena, miniblock->left) +
+           treap_stored(arena, miniblock->right);
+}
+#endif
+
+// Function to fill in the totals shown at the top of the memory map
+void vma_stats(const arena_t *arena, vma_stats_t *stats)
+{
+    stats->arena_size = arena->arena_size;
+    stats->allocated_size = arena->alloc_list->data_size;
+    stats->block_count = arena->alloc_list->size;
+    stats->miniblock_count = arena->miniblock_count;
+
+    // Pool entries handed out so far, the table of chunks, every block with its list node,
+    // the arena and the list; released entries stay in the pool and are counted as well
+    stats->miniblock_node_size = sizeof(miniblock_t);
+    stats->pool_size = arena->chunk_count * POOL_CHUNK_SIZE * sizeof(miniblock_t);
+    stats->metadata_size = (arena->pool_next - 1) * sizeof(miniblock_t) +
+                           arena->chunk_count * sizeof(miniblock_t *) +
+                           arena->alloc_list->size * (sizeof(block_t) + sizeof(node_t)) +
+                           sizeof(arena_t) + sizeof(list_t);
+}
+
+// Function to get the size of an arena
+uint64_t vma_arena_size(const arena_t *arena)
+{
+    return arena->arena_size;
+}
+
+// Function to check whether an arena keeps its data in a file
+int vma_file_backed(const arena_t *arena)
+{
+    return arena->fd >= 0;
+}
+
+// Function to fill in the counters and limits of an arena's paged storage
+vma_status_t vma_page_stats(const arena_t *arena, vma_page_stats_t *stats)
+{
+    if (arena->pages == NULL)
+        return VMA_ERR_UNSUPPORTED;
+    stats->counters = arena->pages->stats;
+    stats->hot_bytes = arena->pages->ring_bytes;
+    stats->hot_limit = arena->pages->hot_limit;
+    stats->resident_limit = arena->pages->resident_limit;
+    stats->swapping = arena->pages->swap_file != NULL;
+    return VMA_OK;
+}
+
+// Function to fill in the settings and buckets of an arena's heat map
+vma_status_t vma_heat_get(const arena_t *arena, vma_heat_info_t *info)
+{
+    if (arena->heat == NULL)
+        return VMA_ERR_UNSUPPORTED;
+    info->sample_rate = arena->heat->sample_rate;
+    info->bucket_size = arena->heat->bucket_size;
+    info->bucket_count = arena->heat->bucket_count;
+    info->buckets = arena->heat->buckets;
+    return VMA_OK;
+}
+
+// Function to start walking the memory map of an arena
+void vma_pmap_begin(const arena_t *arena, vma_pmap_iter_t *iter)
+{
+    iter->arena = arena;
+    iter->block = NULL;
+    iter->miniblock = 0;
+    iter->block_index = 0;
+    iter->miniblock_index = 0;
+}
+
+// Function to get the next record of the memory map, returns 0 once the map is over
+int vma_pmap_next(vma_pmap_iter_t *iter, vma_record_t *record)
+{
     block_t *block = NULL;
+    miniblock_t *miniblock = NULL;
+
+    // Move on to the next miniblock of the current block, if there is one
+    if (iter->block != NULL)
+    {
+        block = iter->block->data;
+        if (iter->miniblock == 0)
+            iter->miniblock = treap_find(iter->arena, block->miniblock_tree, block->start_address);
+        else
+            iter->miniblock = treap_next(iter->arena, block->miniblock_tree,
+                                         get_miniblock(iter->arena, iter->miniblock)->start_address);
+
+        if (iter->miniblock != 0)
+        {
+            miniblock = get_miniblock(iter->arena, iter->miniblock);
+            record->type = VMA_RECORD_MINIBLOCK;
+            record->index = ++iter->miniblock_index;
+            record->start_address = miniblock->start_address;
+            record->end_address = miniblock->start_address + miniblock->size;
+            record->perm = MB_PERM(miniblock);
+            record->stored_size = 0;
+#ifndef VMA_COMPACT
+            if (iter->arena->pages != NULL)
+                record->stored_size = page_table_stored(miniblock->rw_buffer);
+#endif
+            if (iter->arena->heat != NULL && iter->miniblock < iter->arena->heat->miniblock_capacity)
+                record->heat = iter->arena->heat->miniblocks[iter->miniblock];
+            else
+                memset(&record->heat, 0, sizeof(vma_heat_counter_t));
+            return 1;
+        }
+    }
+
+    // Otherwise move on to the next block
+    if (iter->block != NULL)
+        iter->block = iter->block->next;
+    else if (iter->block_index == 0)
+        iter->block = iter->arena->alloc_list->head;
+    if (iter->block == NULL)
+        return 0;
+
+    block = iter->block->data;
+    iter->miniblock = 0;
+    iter->miniblock_index = 0;
+    record->type = VMA_RECORD_BLOCK;
+    record->index = ++iter->block_index;
+    record->start_address = block->start_address;
+    record->end_address = block->start_address + block->size;
+    record->perm = 0;
+    memset(&record->heat, 0, sizeof(vma_heat_counter_t));
+    record->stored_size = 0;
+#ifndef VMA_COMPACT
+    if (iter->arena->pages != NULL)
+        record->stored_size = treap_stored(iter->arena, block->miniblock_tree);
+#endif
+    return 1;
+}
+
+// Function to order diff entries by address, blocks before their miniblocks
+static int compare_diff(const void *a, const void *b)
+{
+    const vma_diff_t *left = a;
+    const vma_diff_t *right = b;
+
+    if (left->start_address != right->start_address)
+        return left->start_address < right->start_address ? -1 : 1;
+    if (left->type != right->type)
+        return left->type < right->type ? -1 : 1;
+    return left->kind < right->kind ? -1 : left->kind > right->kind;
+}
+
+// Function to report every entry of the map as added, for a first diff
+static vma_status_t full_diff(arena_t *arena, vma_diff_t **diff, size_t *count)
+{
+    vma_pmap_iter_t iter;
+    vma_record_t record;
 
-    // Iterate through allocated blocks and their miniblocks to find the specified address
-    node_t *counter = arena->alloc_list->head;
-    for (uint64_t i = 0; i < arena->alloc_list->size; i++)
+    *diff = malloc((arena->alloc_list->size + arena->miniblock_count + 1) * sizeof(vma_diff_t));
+    if (*diff == NULL)
+        return VMA_ERR_NO_MEMORY;
+
+    vma_pmap_begin(arena, &iter);
+    while (vma_pmap_next(&iter, &record))
     {
-        block = counter->data;
-        mini_list = block->miniblock_list;
-        mini_node = mini_list->head;
+        (*diff)[*count].kind = VMA_DIFF_ADDED;
+        (*diff)[*count].type = record.type;
+        (*diff)[*count].start_address = record.start_address;
+        (*diff)[*count].end_address = record.end_address;
+        (*diff)[*count].old_end_address = 0;
+        (*diff)[*count].perm = record.perm;
+        (*diff)[*count].old_perm = 0;
+        (*count)++;
+    }
+    vma_diff_reset(arena);
+    return VMA_OK;
+}
 
-        // Iterate through miniblocks in the current block
-        for (uint64_t j = 0; j < mini_list->size; j++)
+// Function to fill in the diff entry of an address from the entry the last map had there
+// and what is there now, returns 0 if there is nothing to report
+static int diff_entry(const vma_change_t *old, const int exists, const uint64_t end, const uint8_t perm,
+                      vma_diff_t *entry)
+{
+    entry->type = old->type;
+    entry->start_address = old->start_address;
+    entry->end_address = exists ? end : old->end_address;
+    entry->old_end_address = 0;
+    entry->perm = exists ? perm : old->perm;
+    entry->old_perm = 0;
+    if (!old->existed && !exists)
+        return 0; // Came and went between the two maps
+    if (!old->existed)
+        entry->kind = VMA_DIFF_ADDED;
+    else if (!exists)
+        entry->kind = VMA_DIFF_REMOVED;
+    else if (old->end_address != end)
+        entry->kind = VMA_DIFF_RESIZED;
+    else if (old->perm != perm)
+        entry->kind = VMA_DIFF_REPROTECTED;
+    else
+        return 0; // Changed and changed back
+    if (entry->kind == VMA_DIFF_RESIZED || entry->kind == VMA_DIFF_REPROTECTED)
+    {
+        entry->old_end_address = old->end_address;
+        entry->old_perm = old->perm;
+    }
+    return 1;
+}
+
+// Function to report what changed since the last map was kept whole, comparing both maps
+static vma_status_t baseline_diff(arena_t *arena, vma_diff_t **diff, size_t *count)
+{
+    vma_change_t *current = NULL;
+    vma_change_t added;
+    size_t current_count = 0;
+    size_t i = 0;
+    size_t j = 0;
+    int order = 0;
+
+    current = map_entries(arena, &current_count);
+    *diff = malloc((current_count + arena->baseline_count + 1) * sizeof(vma_diff_t));
+    if (current == NULL || *diff == NULL)
+    {
+        free(current);
+        free(*diff);
+        *diff = NULL;
+        return VMA_ERR_NO_MEMORY;
+    }
+
+    while (i < current_count || j < arena->baseline_count)
+    {
+        order = i == current_count ? 1 : j == arena->baseline_count ? -1 : compare_change(&current[i], &arena->baseline[j]);
+        if (order < 0)
         {
-            miniblock = mini_node->data; // Get the current miniblock
+            added = current[i];
+            added.existed = 0;
+            *count += diff_entry(&added, 1, current[i].end_address, current[i].perm, &(*diff)[*count]);
+            i++;
+            continue;
+        }
+        *count += diff_entry(&arena->baseline[j], order == 0, order == 0 ? current[i].end_address : 0,
+                             order == 0 ? current[i].perm : 0, &(*diff)[*count]);
+        i += order == 0;
+        j++;
+    }
+    free(current);
+
+    qsort(*diff, *count, sizeof(vma_diff_t), compare_diff);
+    vma_diff_reset(arena);
+    return VMA_OK;
+}
+
+// Function to report what changed in the map since the last diff or reset. Only the
+// addresses in the change log are looked at, the entry logged for an address holding what
+// it was in the last map. The blocks are walked once, up to the last address logged.
+vma_status_t vma_pmap_diff(arena_t *arena, vma_diff_t **diff, size_t *count)
+{
+    node_t *block_node = arena->alloc_list->head; // Walks the blocks for the block changes
+    node_t *mini_node = arena->alloc_list->head;  // Walks them again for the miniblock changes
+    block_t *block = NULL;
+    miniblock_t *miniblock = NULL;
+    mb_index_t index = 0;
+    vma_change_t *old = NULL;
+    uint64_t end = 0;
+    uint8_t perm = 0;
+    int exists = 0;
+    size_t i = 0;
+
+    *diff = NULL;
+    *count = 0;
+    if (!arena->diff_tracking)
+        return full_diff(arena, diff, count);
+    if (arena->baseline != NULL)
+        return baseline_diff(arena, diff, count);
+
+    *diff = malloc((arena->change_count + 1) * sizeof(vma_diff_t));
+    if (*diff == NULL)
+        return VMA_ERR_NO_MEMORY;
+
+    // The log is sorted, so both walks over the blocks only move forward; the set of logged
+    // addresses is emptied first, as sorting moves the entries it points to
+    clear_change_slots(arena);
+    qsort(arena->changes, arena->change_count, sizeof(vma_change_t), compare_change);
+    for (i = 0; i < arena->change_count; i++)
+    {
+        old = &arena->changes[i];
 
-            // Check if the start address of the miniblock matches the given address
-            if (miniblock->start_address == address)
+        // Look up what starts at the address now
+        exists = 0;
+        if (old->type == VMA_RECORD_BLOCK)
+        {
+            while (block_node != NULL && ((block_t *)block_node->data)->start_address < old->start_address)
+                block_node = block_node->next;
+            block = block_node != NULL ? block_node->data : NULL;
+            if (block != NULL && block->start_address == old->start_address)
             {
-                valid_address = 1;
-                minichosen_block = miniblock;
+                exists = 1;
+                end = block->start_address + block->size;
+                perm = 0;
             }
-            mini_node = mini_node->next; // Move to the next miniblock
         }
-        counter = counter->next; // Move to the next block
+        else
+        {
+            while (mini_node != NULL && ((block_t *)mini_node->data)->start_address +
+                                                ((block_t *)mini_node->data)->size <= old->start_address)
+                mini_node = mini_node->next;
+            block = mini_node != NULL ? mini_node->data : NULL;
+            index = block != NULL ? treap_find(arena, block->miniblock_tree, old->start_address) : 0;
+            if (index != 0)
+            {
+                miniblock = get_miniblock(arena, index);
+                exists = 1;
+                end = miniblock->start_address + miniblock->size;
+                perm = MB_PERM(miniblock);
+            }
+        }
+
+        // Compare it with the entry of the last map
+        *count += diff_entry(old, exists, end, perm, &(*diff)[*count]);
     }
 
-    // If the given address is not found in the allocated memory
-    if (!valid_address)
+    qsort(*diff, *count, sizeof(vma_diff_t), compare_diff);
+    arena->change_count = 0;
+    vma_diff_reset(arena);
+    return VMA_OK;
+}
+
+// Function to make the current map the one the next diff is taken against
+void vma_diff_reset(arena_t *arena)
+{
+    clear_change_slots(arena);
+    free(arena->baseline);
+    arena->baseline = NULL;
+    arena->baseline_count = 0;
+    arena->diff_tracking = 1;
+    arena->change_count = 0;
+}
+
+// Function to check whether an arena logs the changes to its map
+int vma_diff_tracking(const arena_t *arena)
+{
+    return arena->diff_tracking;
+}
+
+// Function to describe a status code
+const char *vma_strerror(const vma_status_t status)
+{
+    switch (status)
     {
-        printf("Invalid address for mprotect.\n"); // Print error message
-        return;
+    case VMA_OK:
+        return "Success";
+    case VMA_ERR_ADDRESS_OUTSIDE:
+        return "The allocated address is outside the size of the arena";
+    case VMA_ERR_END_OUTSIDE:
+        return "The end address is past the size of the arena";
+    case VMA_ERR_ALREADY_ALLOCATED:
+        return "This zone was already allocated";
+    case VMA_ERR_INVALID_ADDRESS:
+        return "Invalid address";
+    case VMA_ERR_PERMISSION:
+        return "Invalid permissions";
+    case VMA_ERR_NO_MEMORY:
+        return "Out of memory";
+    case VMA_ERR_IO:
+        return "Input/output error";
+    case VMA_ERR_UNSUPPORTED:
+        return "Not supported by the storage of the arena";
+    case VMA_ERR_ARENA_FULL:
+        return "No free zone of the arena is large enough";
+    case VMA_ERR_NAME:
+        return "The arena name is already in use or too long";
+    case VMA_ERR_MINIBLOCK_LIMIT:
+        return "The arena holds as many miniblocks as it can";
     }
-
-    minichosen_block->perm = *permission; // Set the permissions of the chosen miniblock to the given value
+    return "Unknown error";
 }
@@ -5,75 +5,210 @@
 #include <stdlib.h>
 #include <string.h>
 
-// Definition of a doubly-linked list node
-typedef struct node_t
+// Permission bits of a miniblock, combined with bitwise OR
+#define VMA_PROT_NONE 0
+#define VMA_PROT_READ 4
+#define VMA_PROT_WRITE 2
+#define VMA_PROT_EXEC 1
+
+// Status codes returned by the library
+typedef enum
+{
+	VMA_OK = 0,
+	VMA_ERR_ADDRESS_OUTSIDE,   // The start address is outside the arena
+	VMA_ERR_END_OUTSIDE,	   // The end address is past the end of the arena
+	VMA_ERR_ALREADY_ALLOCATED, // The zone overlaps an allocated block
+	VMA_ERR_INVALID_ADDRESS,   // Nothing (or no miniblock start) at the address
+	VMA_ERR_PERMISSION,		   // A miniblock of the block denies the access
+	VMA_ERR_NO_MEMORY,		   // The host ran out of memory
+	VMA_ERR_IO,				   // The backing file could not be created, mapped or synced
+	VMA_ERR_UNSUPPORTED,	   // The storage of the arena cannot do this
+	VMA_ERR_ARENA_FULL,		   // No free zone of the arena is large enough
+	VMA_ERR_NAME,			   // The arena name is already in use, or too long
+	VMA_ERR_MINIBLOCK_LIMIT	   // The arena holds VMA_MAX_MINIBLOCKS miniblocks already
+} vma_status_t;
+
+#ifdef VMA_COMPACT
+// Compact layout: offsets and sizes fit in 32 bits, so arenas must be smaller than 4 GiB
+#define VMA_MAX_ARENA_SIZE ((uint64_t)UINT32_MAX)
+// Most miniblocks an arena can hold, bounded by the 26 bits left for the packed subtree count
+#define VMA_MAX_MINIBLOCKS ((1u << 26) - 1)
+#else
+#define VMA_MAX_ARENA_SIZE UINT64_MAX
+// Most miniblocks an arena can hold, bounded by the pool index (0 stands for none)
+#define VMA_MAX_MINIBLOCKS ((uint64_t)UINT32_MAX - 1)
+#endif
+
+// Definition of the arena; its layout is private to the library, which hands out pointers
+typedef struct arena_t arena_t;
+
+// Definition of the access counters of a miniblock or an address bucket. Only sampled
+// accesses are counted, each one weighted by the sampling rate, so they estimate the totals.
+typedef struct
+{
+	uint64_t reads, writes;
+	uint64_t read_bytes, write_bytes;
+} vma_heat_counter_t;
+
+// Definition of the page counters of an arena
+typedef struct
+{
+	uint64_t zero_pages;
+	uint64_t fill_pages;
+	uint64_t raw_pages;
+	uint64_t packed_pages;
+	uint64_t shared_pages;
+	uint64_t stored_bytes; // Bytes of page data held in memory
+	uint64_t compressions;
+	uint64_t decompressions;
+	uint64_t swapped_pages;
+	uint64_t scanned_pages; // Pages looked at by every deduplication so far
+	uint64_t saved_bytes;	// Bytes not stored thanks to sharing
+	uint64_t faults;		// Swapped pages read back
+	uint64_t evictions;		// Pages written out to the swap file
+	uint64_t swap_in_bytes;
+	uint64_t swap_out_bytes;
+} vma_page_counters_t;
+
+// Definition of the state of an arena's paged storage
+typedef struct
+{
+	vma_page_counters_t counters;
+	uint64_t hot_bytes;		 // Bytes of raw pages in the hot ring
+	uint64_t hot_limit;
+	uint64_t resident_limit; // Bytes of page data kept in memory while swapping
+	int swapping;			 // Whether cold pages go to a swap file
+} vma_page_stats_t;
+
+// Definition of the settings and address buckets of an arena's heat map
+typedef struct
 {
-	void *data;
-	struct node_t *next, *prev;
-} node_t;
+	uint32_t sample_rate; // One access in sample_rate is counted
+	uint64_t bucket_size; // Bytes of address space per bucket
+	size_t bucket_count;
+	const vma_heat_counter_t *buckets; // Valid until the heat map is configured again
+} vma_heat_info_t;
 
-// Definition of a doubly-linked list
+// Kinds of records produced while walking the memory map
+typedef enum
+{
+	VMA_RECORD_BLOCK,
+	VMA_RECORD_MINIBLOCK
+} vma_record_type_t;
+
+// Definition of the totals shown at the top of a memory map
 typedef struct
 {
-	size_t size;
-	size_t data_size;
-	node_t *tail, *head;
-} list_t;
+	uint64_t arena_size;
+	uint64_t allocated_size;
+	size_t block_count;
+	size_t miniblock_count;
+	size_t metadata_size;	   // Bytes of host memory spent on blocks and handed-out miniblocks
+	size_t miniblock_node_size; // Bytes of one miniblock in the pool
+	size_t pool_size;		   // Bytes reserved by the miniblock pool, including unused entries
+} vma_stats_t;
 
-// Definition of a block in the arena
+// Definition of one record of the memory map; indices start at 1, as in PMAP
 typedef struct
 {
+	vma_record_type_t type;
+	size_t index;
 	uint64_t start_address;
-	size_t size;
-	void *miniblock_list;
-} block_t;
+	uint64_t end_address;
+	uint8_t perm;			 // Only set for miniblocks
+	vma_heat_counter_t heat; // Sampled accesses of a miniblock, zero unless sampling is on
+	uint64_t stored_size;	 // Bytes of memory holding the data, only set with paged storage
+} vma_record_t;
+
+// Kinds of changes reported by a memory map diff
+typedef enum
+{
+	VMA_DIFF_REMOVED,
+	VMA_DIFF_ADDED,
+	VMA_DIFF_RESIZED,
+	VMA_DIFF_REPROTECTED
+} vma_diff_kind_t;
 
-// Definition of a miniblock within a block
+// Definition of one entry of a memory map diff
 typedef struct
 {
+	vma_diff_kind_t kind;
+	vma_record_type_t type;
 	uint64_t start_address;
-	size_t size;
-	uint8_t perm;
-	void *rw_buffer;
-} miniblock_t;
+	uint64_t end_address;	  // The old end for removed entries
+	uint64_t old_end_address; // Only set for resized entries
+	uint8_t perm;			  // Miniblocks only
+	uint8_t old_perm;		  // Miniblocks that were resized or reprotected
+} vma_diff_t;
 
-// Definition of the arena
+// Definition of an iterator over the memory map, blocks in address order,
+// each one followed by its miniblocks. The arena must not change while it is used.
 typedef struct
 {
-	uint64_t arena_size;
-	list_t *alloc_list;
-} arena_t;
-
-// Function prototypes for creating, manipulating, and deallocating data structures
-list_t *create_list();
-node_t *create_node();
-void insert_node_at_end(node_t **head, node_t **tail, node_t *new_node);
-void insert_node_at_begging(node_t **head, node_t *new_node);
-void delete_list(node_t *head, int is_block_or_miniblock);
-void delete_node_data(node_t *node, int is_block_or_miniblock);
-void delete_node_from_list(list_t *list, node_t *node);
+	const arena_t *arena;
+	const struct node_t *block; // Block whose miniblocks are being listed
+	uint32_t miniblock;			// Last miniblock returned, 0 before the first one
+	size_t block_index;
+	size_t miniblock_index;
+} vma_pmap_iter_t;
 
 // Function prototypes for arena management
-arena_t *alloc_arena(const uint64_t size);
-void dealloc_arena(arena_t *arena);
-
-// Function prototypes for allocation, deallocation, and manipulation of blocks and miniblocks
-int check_already_allocated(arena_t *arena, const uint64_t address,
-							const uint64_t size);
-node_t *check_have_left_neighbour(arena_t *arena, const uint64_t address);
-node_t *check_have_right_neighbour(arena_t *arena, const uint64_t address,
-								   const uint64_t size);
-void alloc_block(arena_t *arena, const uint64_t address, const uint64_t size);
-node_t *find_miniblock_using_address(arena_t *arena, const uint64_t address,
-									 node_t **return_block);
-void free_block(arena_t *arena, const uint64_t address);
-
-// Function prototypes for reading and writing data
-void read(arena_t *arena, uint64_t address, uint64_t size);
-void write(arena_t *arena, const uint64_t address, const uint64_t size,
-		   int8_t *dataa);
+arena_t *vma_alloc_arena(const uint64_t size);
+arena_t *vma_alloc_arena_file(const uint64_t size, const char *path);
+vma_status_t vma_flush(arena_t *arena);
+void vma_dealloc_arena(arena_t *arena);
+
+// Function prototypes for allocation and deallocation of blocks and miniblocks
+vma_status_t vma_alloc_block(arena_t *arena, const uint64_t address, const uint64_t size);
+vma_status_t vma_free_block(arena_t *arena, const uint64_t address);
+vma_status_t vma_miniblock_size(const arena_t *arena, const uint64_t address, uint64_t *size);
+vma_status_t vma_block_remaining(const arena_t *arena, const uint64_t address, uint64_t *remaining);
+
+// Function prototype for allocating by size: the block goes in the lowest free zone it fits
+// in, at an address that is a multiple of align
+vma_status_t vma_malloc(arena_t *arena, const uint64_t size, const uint64_t align, uint64_t *address);
+
+// Function prototypes for reading and writing data; *done is set to the number of
+// bytes copied, which is less than size when the block ends first
+vma_status_t vma_read(arena_t *arena, const uint64_t address, const uint64_t size,
+					  void *buffer, uint64_t *done);
+vma_status_t vma_write(arena_t *arena, const uint64_t address, const uint64_t size,
+					   const void *data, uint64_t *done);
 
 // Function prototypes for memory protection management
-int8_t mprotect_aux(char *string);
-void pmap(const arena_t *arena);
-void mprotect(arena_t *arena, uint64_t address, int8_t *permission);
\ No newline at end of file
+vma_status_t vma_mprotect(arena_t *arena, const uint64_t address, const uint8_t perm);
+
+// Function prototype for the access heat map; a sample rate of 0 turns it off,
+// anything else resets the counters and splits the arena into bucket_count buckets
+vma_status_t vma_heat_config(arena_t *arena, const uint32_t sample_rate, const size_t bucket_count);
+
+// Function prototype for paged storage: all-zero and single-byte pages become markers, and
+// raw pages past the hot_limit bytes accessed most recently are run-length encoded
+vma_status_t vma_paging_config(arena_t *arena, const uint64_t hot_limit);
+
+// Function prototype for deduplication: pages of paged storage with identical content are
+// shared until written; vma_page_stats() gives the counters
+vma_status_t vma_dedup(arena_t *arena);
+
+// Function prototype for swapping: once paged storage holds more than resident_limit bytes,
+// the pages accessed least recently go to a swap file until they are accessed again
+vma_status_t vma_swap_config(arena_t *arena, const uint64_t resident_limit);
+
+// Function prototypes for inspecting the arena; vma_page_stats() and vma_heat_get() return
+// VMA_ERR_UNSUPPORTED while the arena has no paged storage or sampling is off
+uint64_t vma_arena_size(const arena_t *arena);
+int vma_file_backed(const arena_t *arena);
+vma_status_t vma_page_stats(const arena_t *arena, vma_page_stats_t *stats);
+vma_status_t vma_heat_get(const arena_t *arena, vma_heat_info_t *info);
+void vma_stats(const arena_t *arena, vma_stats_t *stats);
+void vma_pmap_begin(const arena_t *arena, vma_pmap_iter_t *iter);
+int vma_pmap_next(vma_pmap_iter_t *iter, vma_record_t *record);
+const char *vma_strerror(const vma_status_t status);
+
+// Function prototypes for memory map diffs. vma_pmap_diff() returns, in an array the caller
+// frees, what changed since the last diff or reset, sorted by address; the first diff of an
+// arena reports every entry as added. vma_diff_reset() makes the current map the baseline.
+// vma_diff_tracking() tells whether changes are being logged, once either has been called.
+vma_status_t vma_pmap_diff(arena_t *arena, vma_diff_t **diff, size_t *count);
+void vma_diff_reset(arena_t *arena);
+int vma_diff_tracking(const arena_t *arena);
@@ -0,0 +1,122 @@
+#pragma once
+#include "pagestore.h"
+#include "vma.h"
+
+// Layout of the arena and its maps, shared by the files of the library only. Programs
+// using the library go through the functions of vma.h instead.
+
+// Definition of a doubly-linked list node
+typedef struct node_t
+{
+	void *data;
+	struct node_t *next, *prev;
+} node_t;
+
+// Definition of a doubly-linked list
+typedef struct
+{
+	size_t size;
+	size_t data_size;
+	node_t *tail, *head;
+} list_t;
+
+// Index of a miniblock in the pool of its arena, 0 stands for none
+typedef uint32_t mb_index_t;
+
+#ifdef VMA_COMPACT
+typedef uint32_t vma_addr_t;
+typedef uint32_t vma_packed_t;
+#else
+typedef uint64_t vma_addr_t;
+typedef uint64_t vma_packed_t;
+#endif
+
+// Definition of a miniblock, which is also a node of the treap (ordered by start address)
+// holding the miniblocks of its block. Nodes are augmented with totals of their subtree.
+typedef struct
+{
+	vma_addr_t start_address;
+	vma_addr_t size;
+	vma_addr_t data_size;  // Number of bytes in the subtree
+	mb_index_t left, right;
+	vma_packed_t packed;   // Subtree miniblock count << 6 | AND of the subtree permissions << 3 | perm
+#ifndef VMA_COMPACT
+	void *rw_buffer;	   // The compact layout keeps data in the arena's flat mapping instead
+#endif
+} miniblock_t;
+
+// Definition of a block in the arena
+typedef struct
+{
+	uint64_t start_address;
+	size_t size; // Always equal to the data_size of the miniblock tree root
+	mb_index_t miniblock_tree;
+} block_t;
+
+// Definition of the sampled access heat map of an arena
+typedef struct
+{
+	uint32_t sample_rate; // One access in sample_rate is counted
+	uint32_t tick;		  // Accesses since the last sampled one
+	uint64_t bucket_size; // Bytes of address space per bucket
+	size_t bucket_count;
+	vma_heat_counter_t *buckets;
+	vma_heat_counter_t *miniblocks; // Indexed like the miniblock pool, grown on demand
+	size_t miniblock_capacity;
+} vma_heat_t;
+
+// Definition of a map entry as it was before a change. One is logged for every address
+// whose block or miniblock changes, the first time it does after the last map.
+typedef struct
+{
+	vma_record_type_t type;
+	uint64_t start_address;
+	uint64_t end_address;
+	uint8_t perm;
+	uint8_t existed; // 0 if nothing started at the address yet
+} vma_change_t;
+
+// Definition of the arena
+struct arena_t
+{
+	uint64_t arena_size;
+	list_t *alloc_list; // Blocks, sorted by start address
+	size_t miniblock_count;
+
+	// Pool the miniblocks are allocated from, in chunks that never move
+	miniblock_t **chunks;
+	size_t chunk_count;
+	mb_index_t pool_next; // First index never handed out
+	mb_index_t pool_free; // Free list of released indices, linked through left
+
+	// Pool the blocks are allocated from along with their list nodes, likewise
+	struct block_node_t **block_chunks;
+	size_t block_chunk_count;
+	size_t block_next;				 // First entry never handed out
+	struct block_node_t *block_free; // Free list of released entries, linked through next
+
+	// Arena-wide data mapping, indexed by address, so the data of a miniblock sits at the
+	// file offset equal to its start address. Used by the compact layout and file-backed arenas.
+	uint8_t *flat;
+	int fd;			   // Backing file of the mapping, -1 for anonymous memory
+	uint64_t read_next; // Address right after the last read, to spot sequential reads
+
+	vma_heat_t *heat; // Access heat map, NULL unless sampling is on
+
+	// Paged storage of miniblock data, which rw_buffer then points to the page table of.
+	// NULL while every miniblock has a plain buffer.
+	vma_page_store_t *pages;
+
+	// Changes made since the last map, logged once a diff has been asked for. Once the log
+	// outgrows the map, the last map is rebuilt and kept whole instead, and nothing is logged.
+	int diff_tracking;
+	vma_change_t *changes;
+	size_t change_count;
+	size_t change_capacity;
+	size_t *change_slots;	  // Logged addresses, open-addressed, holding change index + 1
+	size_t change_slot_count; // A power of two, at least twice the entries logged
+	vma_change_t *baseline;	  // The last map, sorted like the log, NULL while logging
+	size_t baseline_count;
+
+	struct vma_central_t *central; // Size-class front end, NULL until one is created
+};
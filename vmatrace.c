@@ -0,0 +1,591 @@
+#define _GNU_SOURCE // For RTLD_NEXT
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "trace.h" // Include the header file for the allocation traces
+#include "vma.h"
+
+// LD_PRELOAD shim recording the allocations of a process as simulator commands:
+//   VMA_TRACE_FILE=<path> (vma.trace by default) VMA_TRACE_FORMAT=text|binary
+//   LD_PRELOAD=./libvmatrace.so <program>
+// Every process has an address space of its own, so each gets a trace of its own: the
+// process started first writes <path>, the ones it forks or execs write <path>.<pid>.
+
+// Added to the environment by the first traced process, so its descendants know they are ones
+#define TRACE_CHILD_ENV "VMA_TRACE_CHILD"
+
+extern char **environ;
+
+// Bytes a thread gathers before writing them out
+#define TRACE_BUFFER_SIZE (1 << 16)
+// Room kept for the longest record, so a record is never split
+#define TRACE_RECORD_MAX 96
+// Memory handed out while dlsym looks up the real functions
+#define BOOTSTRAP_SIZE 4096
+
+// Thread-local variables must not be allocated lazily, since that would call malloc
+#define TRACE_TLS __thread __attribute__((tls_model("initial-exec")))
+
+// Definition of the records a thread has not written out yet
+typedef struct trace_buffer_t
+{
+    char data[TRACE_BUFFER_SIZE];
+    size_t len;
+    uint32_t count;
+    uint64_t first_seq; // Sequence numbers of the first and last record of the chunk
+    uint64_t last_seq;
+    uint64_t address;   // Address of the last record, the next one is stored relative to it
+    struct trace_buffer_t *prev;
+    struct trace_buffer_t *next;
+} trace_buffer_t;
+
+// The functions being traced
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static void *(*real_mmap)(void *, size_t, int, int, int, off_t);
+static int (*real_munmap)(void *, size_t);
+static int (*real_mprotect)(void *, size_t, int);
+
+static int trace_fd = -1;
+static int binary = 0;
+static char trace_path[4096]; // VMA_TRACE_FILE, read once as the program may change its environment
+static uint64_t next_seq = 1; // Orders the calls of every thread, changed atomically
+static pthread_key_t buffer_key;
+
+// Every thread's buffer, so they can all be written out at exit; the lock also keeps the
+// chunks of different threads from interleaving in the file
+static trace_buffer_t *buffers = NULL;
+static pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static TRACE_TLS trace_buffer_t *thread_buffer = NULL;
+static TRACE_TLS int busy = 0; // Set while the tracer runs, so its own calls are not traced
+
+static char bootstrap[BOOTSTRAP_SIZE] __attribute__((aligned(16)));
+static size_t bootstrap_used = 0;
+static int resolving = 0;
+
+// Function to look up the functions being traced; allocations made meanwhile come from
+// the bootstrap buffer
+static void resolve(void)
+{
+    resolving = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    real_mmap = dlsym(RTLD_NEXT, "mmap");
+    real_munmap = dlsym(RTLD_NEXT, "munmap");
+    real_mprotect = dlsym(RTLD_NEXT, "mprotect");
+    resolving = 0;
+}
+
+// Function to hand out bootstrap memory, zeroed since it is never reused
+static void *bootstrap_alloc(size_t size)
+{
+    void *ptr = NULL;
+
+    size = (size + 15) & ~(size_t)15;
+    if (bootstrap_used + size > BOOTSTRAP_SIZE)
+        return NULL;
+    ptr = bootstrap + bootstrap_used;
+    bootstrap_used += size;
+    return ptr;
+}
+
+// Function to check whether a pointer came from the bootstrap buffer
+static int is_bootstrap(const void *ptr)
+{
+    return (const char *)ptr >= bootstrap && (const char *)ptr < bootstrap + BOOTSTRAP_SIZE;
+}
+
+// Function to write all of a buffer to the trace file
+static void write_all(const char *data, size_t len)
+{
+    ssize_t written = 0;
+
+    while (len > 0)
+    {
+        written = write(trace_fd, data, len);
+        if (written <= 0)
+            return;
+        data += written;
+        len -= written;
+    }
+}
+
+// Function to store a varint, returns its length
+static size_t put_varint(char *out, uint64_t value)
+{
+    size_t len = 0;
+
+    while (value >= 0x80)
+    {
+        out[len++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+    out[len++] = (char)value;
+    return len;
+}
+
+// Function to store a number in decimal, returns its length
+static size_t put_decimal(char *out, uint64_t value)
+{
+    char digits[20];
+    size_t count = 0;
+    size_t len = 0;
+
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    while (count > 0)
+        out[len++] = digits[--count];
+    return len;
+}
+
+// Function to store a string, returns its length
+static size_t put_string(char *out, const char *string)
+{
+    size_t len = strlen(string);
+
+    memcpy(out, string, len);
+    return len;
+}
+
+// Function to write a thread's records out, as a chunk in the binary form
+static void flush_buffer(trace_buffer_t *buffer)
+{
+    char header[30];
+    size_t len = 0;
+
+    if (buffer->len == 0)
+        return;
+    pthread_mutex_lock(&buffers_lock);
+    if (binary)
+    {
+        len = put_varint(header, buffer->first_seq);
+        len += put_varint(header + len, buffer->count);
+        len += put_varint(header + len, buffer->len);
+        write_all(header, len);
+    }
+    write_all(buffer->data, buffer->len);
+    pthread_mutex_unlock(&buffers_lock);
+    buffer->len = 0;
+    buffer->count = 0;
+    buffer->address = 0;
+}
+
+// Function to write out and free a thread's buffer when the thread exits
+static void thread_exit(void *arg)
+{
+    trace_buffer_t *buffer = arg;
+
+    busy = 1;
+    flush_buffer(buffer);
+    pthread_mutex_lock(&buffers_lock);
+    if (buffer->prev != NULL)
+        buffer->prev->next = buffer->next;
+    else
+        buffers = buffer->next;
+    if (buffer->next != NULL)
+        buffer->next->prev = buffer->prev;
+    pthread_mutex_unlock(&buffers_lock);
+    real_free(buffer);
+    thread_buffer = NULL;
+    busy = 0;
+}
+
+// Function to get the calling thread's buffer, creating it on its first record
+static trace_buffer_t *get_buffer(void)
+{
+    trace_buffer_t *buffer = thread_buffer;
+
+    if (buffer != NULL)
+        return buffer;
+    buffer = real_malloc(sizeof(trace_buffer_t));
+    if (buffer == NULL)
+        return NULL;
+    buffer->len = 0;
+    buffer->count = 0;
+    buffer->address = 0;
+    buffer->prev = NULL;
+    pthread_mutex_lock(&buffers_lock);
+    buffer->next = buffers;
+    if (buffers != NULL)
+        buffers->prev = buffer;
+    buffers = buffer;
+    pthread_mutex_unlock(&buffers_lock);
+    pthread_setspecific(buffer_key, buffer);
+    thread_buffer = buffer;
+    return buffer;
+}
+
+// Function to get the sequence number of a call. A free takes its number before the memory
+// is given back and an allocation after it is handed out, so a block reused by another
+// thread is always freed first in the trace.
+static uint64_t take_seq(void)
+{
+    return __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+}
+
+// Function to add a record to the calling thread's buffer
+static void record(const uint8_t type, const uint64_t seq, const uint64_t address,
+                   const uint64_t size, const int prot)
+{
+    trace_buffer_t *buffer = NULL;
+    char *out = NULL;
+    uint8_t perm = 0;
+    uint64_t delta = 0;
+    size_t len = 0;
+
+    if (trace_fd < 0 || busy)
+        return;
+    busy = 1;
+    buffer = get_buffer();
+    if (buffer == NULL)
+    {
+        busy = 0;
+        return;
+    }
+    if (buffer->len + TRACE_RECORD_MAX > TRACE_BUFFER_SIZE)
+        flush_buffer(buffer);
+
+    perm = (prot & PROT_READ ? VMA_PROT_READ : 0) | (prot & PROT_WRITE ? VMA_PROT_WRITE : 0) |
+           (prot & PROT_EXEC ? VMA_PROT_EXEC : 0);
+    out = buffer->data + buffer->len;
+    if (binary)
+    {
+        if (buffer->count == 0)
+            buffer->first_seq = buffer->last_seq = seq;
+        delta = address - buffer->address;
+        out[len++] = type;
+        len += put_varint(out + len, seq - buffer->last_seq);
+        len += put_varint(out + len, (delta << 1) ^ -(delta >> 63)); // Zigzag, small either way
+        if (type == TRACE_ALLOC)
+            len += put_varint(out + len, size);
+        else if (type == TRACE_MPROTECT)
+            out[len++] = perm;
+        buffer->last_seq = seq;
+        buffer->address = address;
+    }
+    else if (type == TRACE_ALLOC)
+    {
+        len = put_string(out, "ALLOC_BLOCK ");
+        len += put_decimal(out + len, address);
+        out[len++] = ' ';
+        len += put_decimal(out + len, size);
+        out[len++] = '\n';
+    }
+    else if (type == TRACE_FREE)
+    {
+        len = put_string(out, "FREE_BLOCK ");
+        len += put_decimal(out + len, address);
+        out[len++] = '\n';
+    }
+    else
+    {
+        len = put_string(out, "MPROTECT ");
+        len += put_decimal(out + len, address);
+        len += put_string(out + len, perm == 0 ? " PROT_NONE" : "");
+        len += put_string(out + len, perm & VMA_PROT_READ ? " PROT_READ |" : "");
+        len += put_string(out + len, perm & VMA_PROT_WRITE ? " PROT_WRITE |" : "");
+        len += put_string(out + len, perm & VMA_PROT_EXEC ? " PROT_EXEC |" : "");
+        if (perm != 0)
+            len -= 2; // The last " |"
+        out[len++] = '\n';
+    }
+    buffer->len += len;
+    buffer->count++;
+    busy = 0;
+}
+
+// Function to look a variable up in the environment. Programs such as shells define getenv
+// themselves, and theirs may not work before their main runs.
+static const char *find_env(const char *name)
+{
+    size_t len = strlen(name);
+    char **env = NULL;
+
+    for (env = environ; env != NULL && *env != NULL; env++)
+        if (strncmp(*env, name, len) == 0 && (*env)[len] == '=')
+            return *env + len + 1;
+    return NULL;
+}
+
+// Function to add the child marker to the environment the process passes on, without setenv
+// for the same reason; the old array is left alone, as the process may still point into it
+static void mark_children(void)
+{
+    static char marker[] = TRACE_CHILD_ENV "=1"; // writable, as shells edit entries in place
+    char **env = NULL;
+    size_t count = 0;
+
+    while (environ != NULL && environ[count] != NULL)
+        count++;
+    env = real_malloc((count + 2) * sizeof(char *));
+    if (env == NULL)
+        return;
+    if (count > 0)
+        memcpy(env, environ, count * sizeof(char *));
+    env[count] = marker;
+    env[count + 1] = NULL;
+    environ = env;
+}
+
+// Function to open the trace file of this process and write its header
+static void open_trace(const int child)
+{
+    char name[sizeof(trace_path) + 24];
+    char header[64];
+    size_t len = 0;
+
+    len = put_string(name, trace_path);
+    if (child)
+    {
+        name[len++] = '.';
+        len += put_decimal(name + len, (uint64_t)getpid());
+    }
+    name[len] = '\0';
+
+    trace_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (trace_fd >= 0 && binary)
+    {
+        write_all(TRACE_MAGIC, TRACE_MAGIC_SIZE);
+    }
+    else if (trace_fd >= 0)
+    {
+        // The arena spans the whole address space, so blocks keep their real addresses
+        len = put_string(header, "ALLOC_ARENA ");
+        len += put_decimal(header + len, TRACE_ARENA_SIZE);
+        header[len++] = '\n';
+        write_all(header, len);
+    }
+}
+
+// Function to keep other threads from writing to the trace while the process forks
+static void fork_prepare(void)
+{
+    pthread_mutex_lock(&buffers_lock);
+}
+
+// Function to let the parent go on writing once it has forked
+static void fork_parent(void)
+{
+    pthread_mutex_unlock(&buffers_lock);
+}
+
+// Function to start the trace of a forked child. The records it inherited belong to the
+// parent, which writes them out itself, and only the forking thread lives on in the child.
+static void fork_child(void)
+{
+    trace_buffer_t *buffer = buffers;
+    trace_buffer_t *next = NULL;
+
+    busy = 1;
+    for (; buffer != NULL; buffer = next)
+    {
+        next = buffer->next;
+        if (buffer != thread_buffer)
+            real_free(buffer);
+    }
+    buffers = thread_buffer;
+    if (thread_buffer != NULL)
+    {
+        thread_buffer->len = 0;
+        thread_buffer->count = 0;
+        thread_buffer->address = 0;
+        thread_buffer->prev = thread_buffer->next = NULL;
+    }
+    pthread_mutex_unlock(&buffers_lock);
+
+    if (trace_fd >= 0)
+        close(trace_fd);
+    open_trace(1);
+    busy = 0;
+}
+
+// Function to open the trace when the shim is loaded
+__attribute__((constructor)) static void trace_start(void)
+{
+    const char *path = find_env("VMA_TRACE_FILE");
+    const char *format = find_env("VMA_TRACE_FORMAT");
+    int child = find_env(TRACE_CHILD_ENV) != NULL;
+
+    if (real_malloc == NULL)
+        resolve();
+    busy = 1;
+    if (path == NULL || strlen(path) >= sizeof(trace_path))
+        path = "vma.trace";
+    strcpy(trace_path, path);
+    binary = format != NULL && strcmp(format, "binary") == 0;
+    pthread_key_create(&buffer_key, thread_exit);
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+    if (!child)
+        mark_children();
+    open_trace(child);
+    busy = 0;
+}
+
+// Function to write out every buffer when the process exits. Threads still running may
+// keep adding records meanwhile; whatever they add after this is lost.
+__attribute__((destructor)) static void trace_stop(void)
+{
+    trace_buffer_t *buffer = NULL;
+
+    busy = 1;
+    for (buffer = buffers; buffer != NULL; buffer = buffer->next)
+        flush_buffer(buffer);
+    trace_fd = -1;
+    busy = 0;
+}
+
+void *malloc(size_t size)
+{
+    void *ptr = NULL;
+
+    if (real_malloc == NULL)
+    {
+        if (resolving)
+            return bootstrap_alloc(size);
+        resolve();
+    }
+    ptr = real_malloc(size);
+    if (ptr != NULL)
+        record(TRACE_ALLOC, take_seq(), (uintptr_t)ptr, size > 0 ? size : 1, 0);
+    return ptr;
+}
+
+void *calloc(size_t count, size_t size)
+{
+    void *ptr = NULL;
+
+    if (real_calloc == NULL)
+    {
+        if (resolving)
+            return bootstrap_alloc(count * size);
+        resolve();
+    }
+    ptr = real_calloc(count, size);
+    if (ptr != NULL)
+        record(TRACE_ALLOC, take_seq(), (uintptr_t)ptr, count * size > 0 ? count * size : 1, 0);
+    return ptr;
+}
+
+void *realloc(void *old, size_t size)
+{
+    uint64_t seq = 0;
+    size_t room = 0;
+    void *ptr = NULL;
+
+    if (real_realloc == NULL)
+        resolve();
+    if (is_bootstrap(old))
+    {
+        // Bootstrap memory cannot grow, move it to the real heap
+        room = bootstrap + BOOTSTRAP_SIZE - (char *)old;
+        ptr = real_malloc(size);
+        if (ptr != NULL)
+            memcpy(ptr, old, size < room ? size : room);
+        return ptr;
+    }
+
+    // A realloc is a free of the old block and an allocation of the new one
+    seq = old != NULL ? take_seq() : 0;
+    ptr = real_realloc(old, size);
+    if (ptr == NULL && size > 0)
+        return NULL; // The old block is left alone
+    if (old != NULL)
+        record(TRACE_FREE, seq, (uintptr_t)old, 0, 0);
+    if (ptr != NULL)
+        record(TRACE_ALLOC, take_seq(), (uintptr_t)ptr, size > 0 ? size : 1, 0);
+    return ptr;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || is_bootstrap(ptr))
+        return;
+    if (real_free == NULL)
+        resolve();
+    record(TRACE_FREE, take_seq(), (uintptr_t)ptr, 0, 0);
+    real_free(ptr);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    int result = 0;
+
+    if (real_posix_memalign == NULL)
+        resolve();
+    result = real_posix_memalign(ptr, alignment, size);
+    if (result == 0)
+        record(TRACE_ALLOC, take_seq(), (uintptr_t)*ptr, size > 0 ? size : 1, 0);
+    return result;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    void *ptr = NULL;
+
+    if (real_aligned_alloc == NULL)
+        resolve();
+    ptr = real_aligned_alloc(alignment, size);
+    if (ptr != NULL)
+        record(TRACE_ALLOC, take_seq(), (uintptr_t)ptr, size > 0 ? size : 1, 0);
+    return ptr;
+}
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+    void *ptr = NULL;
+
+    if (real_mmap == NULL)
+        resolve();
+    ptr = real_mmap(addr, length, prot, flags, fd, offset);
+    if (ptr != MAP_FAILED)
+    {
+        // The simulator's blocks start out readable and writable
+        record(TRACE_ALLOC, take_seq(), (uintptr_t)ptr, length, 0);
+        if ((prot & (PROT_READ | PROT_WRITE | PROT_EXEC)) != (PROT_READ | PROT_WRITE))
+            record(TRACE_MPROTECT, take_seq(), (uintptr_t)ptr, 0, prot);
+    }
+    return ptr;
+}
+
+int munmap(void *addr, size_t length)
+{
+    uint64_t seq = 0;
+    int result = 0;
+
+    if (real_munmap == NULL)
+        resolve();
+    seq = take_seq();
+    result = real_munmap(addr, length);
+    if (result == 0)
+        record(TRACE_FREE, seq, (uintptr_t)addr, 0, 0);
+    return result;
+}
+
+int mprotect(void *addr, size_t length, int prot)
+{
+    int result = 0;
+
+    if (real_mprotect == NULL)
+        resolve();
+    result = real_mprotect(addr, length, prot);
+    if (result == 0)
+        record(TRACE_MPROTECT, take_seq(), (uintptr_t)addr, 0, prot);
+    return result;
+}